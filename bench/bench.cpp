@@ -0,0 +1,200 @@
+// A headless benchmark of whole simulation ticks. Each bundled configuration is
+// run with a fixed seed at several world sizes, and a JSON object describing
+// each run is printed on its own line of standard output.
+
+#include "Config.hpp"
+#include "World.hpp"
+#include <SDL2/SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace anosmellya;
+
+struct BenchSize {
+    unsigned width;
+    unsigned height;
+    // Fewer ticks are run in bigger worlds to keep the runs short:
+    unsigned ticks;
+};
+
+static const char* const conf_names[]
+    = { "default", "aware", "oases", "slow" };
+
+static const BenchSize sizes[] = {
+    { 300, 210, 2000 },
+    { 1000, 700, 200 },
+    { 2000, 2000, 40 },
+    { 4000, 4000, 10 },
+};
+
+#define SEED 1
+// Statistics are collected this often, as with -print-stats by default:
+#define STAT_INTERVAL 10
+
+struct BenchOptions {
+    const char* conf_dir;
+    unsigned max_threads;
+    unsigned ticks; // 0 means the default for each size
+    bool reference_fluids;
+    bool gradient_fields;
+    bool half_fluids;
+    // Negative to use each configuration's own:
+    float skip_threshold;
+};
+
+static void print_help(char* progname)
+{
+    printf("Usage: %s [options]\n", progname);
+    puts("\
+Options:\n\
+ -conf-dir <dir>         Load the configurations from <dir>. The default is\n\
+                         'configurations'.\n\
+ -ticks <ticks>          Run <ticks> ticks at every world size. By default,\n\
+                         bigger worlds run fewer ticks.\n\
+ -max-threads <threads>  The maximum number of threads used for computation.\n\
+                         The default is the number of computer cores.\n\
+ -reference-fluids       Use the original smell dispersal code.\n\
+ -gradient-fields        Work out smell gradients along with the smells.\n\
+ -half-fluids            Store smells in half precision.\n\
+ -skip-threshold <t>     Skip quiet smell blocks with the threshold <t> in\n\
+                         every configuration.\n\
+ -help                   Print this help information.");
+}
+
+static unsigned get_num_arg(char* argv[], int& i)
+{
+    ++i;
+    char* end;
+    long arg = argv[i] ? strtol(argv[i], &end, 10) : 0;
+    if (!argv[i] || *end != '\0' || arg < 1 || arg > 1000000) {
+        fprintf(stderr, "%s: Invalid argument to option %s\n", argv[0],
+            argv[i - 1]);
+        exit(EXIT_FAILURE);
+    }
+    return (unsigned)arg;
+}
+
+static float get_threshold_arg(char* argv[], int& i)
+{
+    ++i;
+    char* end;
+    float arg = argv[i] ? strtof(argv[i], &end) : -1.;
+    if (!argv[i] || *end != '\0' || !(arg >= 0.)) {
+        fprintf(stderr, "%s: Invalid argument to option %s\n", argv[0],
+            argv[i - 1]);
+        exit(EXIT_FAILURE);
+    }
+    return arg;
+}
+
+static void parse_options(BenchOptions& opts, int argc, char* argv[])
+{
+    opts.conf_dir = "configurations";
+    opts.max_threads = 0;
+    opts.ticks = 0;
+    opts.reference_fluids = false;
+    opts.gradient_fields = false;
+    opts.half_fluids = false;
+    opts.skip_threshold = -1.;
+    for (int i = 1; i < argc; ++i) {
+        char* opt = argv[i];
+        if (opt[0] == '-' && opt[1] == '-') {
+            ++opt;
+        }
+        if (!strcmp(opt, "-conf-dir") && argv[i + 1]) {
+            opts.conf_dir = argv[++i];
+        } else if (!strcmp(opt, "-ticks")) {
+            opts.ticks = get_num_arg(argv, i);
+        } else if (!strcmp(opt, "-max-threads")) {
+            opts.max_threads = get_num_arg(argv, i);
+        } else if (!strcmp(opt, "-reference-fluids")) {
+            opts.reference_fluids = true;
+        } else if (!strcmp(opt, "-gradient-fields")) {
+            opts.gradient_fields = true;
+        } else if (!strcmp(opt, "-half-fluids")) {
+            opts.half_fluids = true;
+        } else if (!strcmp(opt, "-skip-threshold")) {
+            opts.skip_threshold = get_threshold_arg(argv, i);
+        } else if (!strcmp(opt, "-help") || !strcmp(opt, "-h")) {
+            print_help(argv[0]);
+            exit(EXIT_SUCCESS);
+        } else {
+            fprintf(stderr, "%s: Invalid option: %s\n", argv[0], argv[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static double to_seconds(uint64_t counts)
+{
+    return (double)counts / (double)SDL_GetPerformanceFrequency();
+}
+
+static void run(BenchOptions const& opts, const char* conf_name,
+    Config const& conf, BenchSize const& size)
+{
+    unsigned ticks = opts.ticks ? opts.ticks : size.ticks;
+    World world(size.width, size.height, SEED, conf, opts.max_threads,
+        opts.reference_fluids, opts.gradient_fields, opts.half_fluids);
+    Statistics stats;
+    uint64_t start = SDL_GetPerformanceCounter();
+    for (unsigned i = 0; i < ticks; ++i) {
+        if (world.get_tick() % STAT_INTERVAL == 0) {
+            world.get_statistics(stats);
+        }
+        world.simulate();
+    }
+    double seconds = to_seconds(SDL_GetPerformanceCounter() - start);
+    world.get_statistics(stats);
+    PhaseTimes const& times = world.get_phase_times();
+    printf("{\"version\":\"" VERSION "\",\"conf\":\"%s\",\"world_width\":%u,"
+           "\"world_height\":%u,\"seed\":%u,\"threads\":%u,"
+           "\"reference_fluids\":%s,\"gradient_fields\":%s,"
+           "\"half_fluids\":%s,\"ticks\":%u",
+        conf_name, size.width, size.height, SEED, world.get_thread_count(),
+        opts.reference_fluids ? "true" : "false",
+        opts.gradient_fields ? "true" : "false",
+        opts.half_fluids ? "true" : "false", ticks);
+    printf(",\"seconds\":%f,\"ticks_per_sec\":%f,\"tiles_per_sec\":%f", seconds,
+        ticks / seconds, (double)size.width * size.height * ticks / seconds);
+    printf(",\"phase_seconds\":{\"fluids\":%f,\"animals\":%f,\"plants\":%f,"
+           "\"stats\":%f}",
+        to_seconds(times.fluids), to_seconds(times.animals),
+        to_seconds(times.plants), to_seconds(times.stats));
+    // The final population, to tell whether runs did the same work:
+    printf(",\"herb_count\":%u,\"carn_count\":%u", stats.herb_count,
+        stats.carn_count);
+    printf(",\"skip_threshold\":%f,\"skipped_fraction\":%f}\n",
+        conf.skip_threshold, stats.skipped_fraction);
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[])
+{
+    BenchOptions opts;
+    parse_options(opts, argc, argv);
+    if (SDL_Init(SDL_INIT_TIMER)) {
+        fprintf(stderr, "SDL initialization failed; %s\n", SDL_GetError());
+        exit(EXIT_FAILURE);
+    }
+    for (unsigned c = 0; c < sizeof(conf_names) / sizeof(*conf_names); ++c) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s.conf", opts.conf_dir,
+            conf_names[c]);
+        Config conf;
+        if (conf.parse(path) < 0) {
+            fprintf(stderr, "%s: Unable to parse configuration from '%s'\n",
+                argv[0], path);
+            exit(EXIT_FAILURE);
+        }
+        if (opts.skip_threshold >= 0.) {
+            conf.skip_threshold = opts.skip_threshold;
+        }
+        for (unsigned s = 0; s < sizeof(sizes) / sizeof(*sizes); ++s) {
+            run(opts, conf_names[c], conf, sizes[s]);
+        }
+    }
+    SDL_Quit();
+    exit(EXIT_SUCCESS);
+}
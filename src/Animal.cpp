@@ -13,14 +13,8 @@ SmellAffinity::SmellAffinity()
 {
 }
 
-Animal::Animal()
-    : pos(0., 0.)
-    , vel(0., 0.)
-    , food(0.)
-    , age(0)
-    , is_present(false)
-    , just_moved(false)
-    , is_carn(false)
+Genome::Genome()
+    : is_carn(false)
     , baby_smell_amount(0.)
     , baby_threshold(0.)
     , baby_food(0.)
@@ -50,13 +44,8 @@ static SmellAffinity pick_aff(
     return aff;
 }
 
-Animal::Animal(Random& random, Animal const& mother, Animal const& father)
-    : pos(mother.pos)
-    , vel(mother.vel)
-    , food(fmaxf(0., fminf(mother.baby_food, mother.food)))
-    , age(0)
-    , is_present(true)
-    , is_carn(mother.is_carn)
+Genome::Genome(Random& random, Genome const& mother, Genome const& father)
+    : is_carn(mother.is_carn)
     , baby_smell_amount(
           pick(random, mother.baby_smell_amount, father.baby_smell_amount))
     , baby_threshold(pick(random, mother.baby_threshold, father.baby_threshold))
@@ -69,11 +58,8 @@ Animal::Animal(Random& random, Animal const& mother, Animal const& father)
 {
 }
 
-void Animal::be_carn()
+void Genome::be_carn()
 {
-    food = 100.;
-    age = 0.;
-    is_present = true;
     is_carn = true;
     baby_smell_amount = 1.;
     baby_threshold = 100.;
@@ -88,11 +74,8 @@ void Animal::be_carn()
     vel_aff.impulse.x = -0.2;
 }
 
-void Animal::be_herb()
+void Genome::be_herb()
 {
-    food = 100.;
-    age = 0.;
-    is_present = true;
     is_carn = false;
     baby_smell_amount = 1.;
     baby_threshold = 100.;
@@ -108,76 +91,104 @@ void Animal::be_herb()
     vel_aff.impulse.x = -0.2;
 }
 
+// The number of traits changed by mutate_affinity:
+#define AFFINITY_TRAITS 7
+
+// Mutate using changes between 0 and 2 * amount, offset by -amount.
 static void mutate_affinity(
-    SmellAffinity& aff, Random& random, float mutate_amount)
+    SmellAffinity& aff, float const* changes, float amount)
 {
-    aff.impulse.x += random.generate_pos_neg(mutate_amount);
-    aff.impulse.y += random.generate_pos_neg(mutate_amount);
-    aff.plant_effect += random.generate_pos_neg(mutate_amount);
-    aff.herb_effect += random.generate_pos_neg(mutate_amount);
-    aff.carn_effect += random.generate_pos_neg(mutate_amount);
-    aff.baby_effect += random.generate_pos_neg(mutate_amount);
-    aff.food_effect += random.generate_pos_neg(mutate_amount);
+    aff.impulse.x += changes[0] - amount;
+    aff.impulse.y += changes[1] - amount;
+    aff.plant_effect += changes[2] - amount;
+    aff.herb_effect += changes[3] - amount;
+    aff.carn_effect += changes[4] - amount;
+    aff.baby_effect += changes[5] - amount;
+    aff.food_effect += changes[6] - amount;
 }
 
-void Animal::mutate(Random& random, float amount)
+void Genome::mutate(Random& random, float amount)
 {
-    baby_smell_amount += random.generate_pos_neg(amount);
-    baby_threshold += random.generate_pos_neg(amount);
-    baby_food += random.generate_pos_neg(amount);
-    mutate_affinity(plant_aff, random, amount);
-    mutate_affinity(herb_aff, random, amount);
-    mutate_affinity(carn_aff, random, amount);
-    mutate_affinity(baby_aff, random, amount);
-    mutate_affinity(vel_aff, random, amount);
+    // Draw all the changes in one batch:
+    float changes[3 + 5 * AFFINITY_TRAITS];
+    random.generate(changes, sizeof(changes) / sizeof(*changes), amount * 2.);
+    baby_smell_amount += changes[0] - amount;
+    baby_threshold += changes[1] - amount;
+    baby_food += changes[2] - amount;
+    float const* aff_changes = changes + 3;
+    mutate_affinity(plant_aff, aff_changes, amount);
+    mutate_affinity(herb_aff, aff_changes + AFFINITY_TRAITS, amount);
+    mutate_affinity(carn_aff, aff_changes + 2 * AFFINITY_TRAITS, amount);
+    mutate_affinity(baby_aff, aff_changes + 3 * AFFINITY_TRAITS, amount);
+    mutate_affinity(vel_aff, aff_changes + 4 * AFFINITY_TRAITS, amount);
 }
 
-static void add_affinities(SmellAffinity& a, SmellAffinity const& b)
+Animal::Animal()
+    : pos(0., 0.)
+    , vel(0., 0.)
+    , food(0.)
+    , age(0)
+    , genome(0)
+    , baby_threshold(0.)
+    , is_carn(false)
+    , just_moved(false)
 {
-    a.impulse.x += b.impulse.x;
-    a.impulse.y += b.impulse.y;
-    a.plant_effect += b.plant_effect;
-    a.herb_effect += b.herb_effect;
-    a.carn_effect += b.carn_effect;
-    a.baby_effect += b.baby_effect;
-    a.food_effect += b.food_effect;
 }
 
-void Animal::add(Animal const& an)
+Animal::Animal(
+    unsigned genome, Genome const& traits, Vec2D pos, Vec2D vel, float food)
+    : pos(pos)
+    , vel(vel)
+    , food(food)
+    , age(0)
+    , genome(genome)
+    , baby_threshold(traits.baby_threshold)
+    , is_carn(traits.is_carn)
+    , just_moved(false)
 {
-    age += an.age;
-    baby_smell_amount += an.baby_smell_amount;
-    baby_threshold += an.baby_threshold;
-    baby_food += an.baby_food;
-    add_affinities(plant_aff, an.plant_aff);
-    add_affinities(herb_aff, an.herb_aff);
-    add_affinities(carn_aff, an.carn_aff);
-    add_affinities(baby_aff, an.baby_aff);
-    add_affinities(vel_aff, an.vel_aff);
 }
 
-static void divide_affinity(SmellAffinity& aff, float d)
+// Put pointers to the traits of the affinity at the cursor, moving it along.
+template <typename A, typename F> static void list_aff_traits(A& aff, F**& at)
+{
+    *at++ = &aff.impulse.x;
+    *at++ = &aff.impulse.y;
+    *at++ = &aff.plant_effect;
+    *at++ = &aff.herb_effect;
+    *at++ = &aff.carn_effect;
+    *at++ = &aff.baby_effect;
+    *at++ = &aff.food_effect;
+}
+
+// Get pointers to the totalled traits of the genome, always in the same order.
+template <typename G, typename F>
+static void list_traits(G& genome, F* traits[Genome::STAT_TRAIT_COUNT])
 {
-    aff.impulse.x /= d;
-    aff.impulse.y /= d;
-    aff.plant_effect /= d;
-    aff.herb_effect /= d;
-    aff.carn_effect /= d;
-    aff.baby_effect /= d;
-    aff.food_effect /= d;
+    F** at = traits;
+    *at++ = &genome.baby_smell_amount;
+    *at++ = &genome.baby_threshold;
+    *at++ = &genome.baby_food;
+    list_aff_traits(genome.plant_aff, at);
+    list_aff_traits(genome.herb_aff, at);
+    list_aff_traits(genome.carn_aff, at);
+    list_aff_traits(genome.baby_aff, at);
+    list_aff_traits(genome.vel_aff, at);
 }
 
-void Animal::divide(float d)
+void Genome::list_stat_traits(float* traits[STAT_TRAIT_COUNT])
+{
+    list_traits(*this, traits);
+}
+
+void Genome::list_stat_traits(float const* traits[STAT_TRAIT_COUNT]) const
+{
+    list_traits(*this, traits);
+}
+
+AnimalStats::AnimalStats()
+    : age(0)
+    , genome()
 {
-    age /= d;
-    baby_smell_amount /= d;
-    baby_threshold /= d;
-    baby_food /= d;
-    divide_affinity(plant_aff, d);
-    divide_affinity(herb_aff, d);
-    divide_affinity(carn_aff, d);
-    divide_affinity(baby_aff, d);
-    divide_affinity(vel_aff, d);
 }
 
 static void print_affinity(SmellAffinity const& aff, FILE* to)
@@ -190,20 +201,74 @@ static void print_affinity(SmellAffinity const& aff, FILE* to)
     fprintf(to, ",\"food_effect\":%f}", aff.food_effect);
 }
 
-void Animal::print(FILE* to)
+void AnimalStats::print(FILE* to)
 {
     fprintf(to, "{\"age\":%u", age);
-    fprintf(to, ",\"baby_smell_amount\":%f", baby_smell_amount);
-    fprintf(to, ",\"baby_threshold\":%f", baby_threshold);
-    fprintf(to, ",\"baby_food\":%f,\"plant_aff\":", baby_food);
-    print_affinity(plant_aff, to);
+    fprintf(to, ",\"baby_smell_amount\":%f", genome.baby_smell_amount);
+    fprintf(to, ",\"baby_threshold\":%f", genome.baby_threshold);
+    fprintf(to, ",\"baby_food\":%f,\"plant_aff\":", genome.baby_food);
+    print_affinity(genome.plant_aff, to);
     fputs(",\"herb_aff\":", to);
-    print_affinity(herb_aff, to);
+    print_affinity(genome.herb_aff, to);
     fputs(",\"carn_aff\":", to);
-    print_affinity(carn_aff, to);
+    print_affinity(genome.carn_aff, to);
     fputs(",\"baby_aff\":", to);
-    print_affinity(baby_aff, to);
+    print_affinity(genome.baby_aff, to);
     fputs(",\"vel_aff\":", to);
-    print_affinity(vel_aff, to);
+    print_affinity(genome.vel_aff, to);
     fputc('}', to);
 }
+
+AnimalTotals::AnimalTotals()
+    : count(0)
+    , age(0)
+{
+    for (unsigned i = 0; i < Genome::STAT_TRAIT_COUNT; ++i) {
+        traits[i] = 0.;
+    }
+}
+
+void AnimalTotals::add(Animal const& an, Genome const& genome)
+{
+    float const* genome_traits[Genome::STAT_TRAIT_COUNT];
+    genome.list_stat_traits(genome_traits);
+    ++count;
+    age += an.age;
+    for (unsigned i = 0; i < Genome::STAT_TRAIT_COUNT; ++i) {
+        traits[i] += *genome_traits[i];
+    }
+}
+
+void AnimalTotals::remove(Animal const& an, Genome const& genome)
+{
+    float const* genome_traits[Genome::STAT_TRAIT_COUNT];
+    genome.list_stat_traits(genome_traits);
+    --count;
+    age -= an.age;
+    for (unsigned i = 0; i < Genome::STAT_TRAIT_COUNT; ++i) {
+        traits[i] -= *genome_traits[i];
+    }
+}
+
+void AnimalTotals::add(AnimalTotals const& other)
+{
+    count += other.count;
+    age += other.age;
+    for (unsigned i = 0; i < Genome::STAT_TRAIT_COUNT; ++i) {
+        traits[i] += other.traits[i];
+    }
+}
+
+void AnimalTotals::average(AnimalStats& stats) const
+{
+    stats = AnimalStats();
+    if (count <= 0) {
+        return;
+    }
+    float* stats_traits[Genome::STAT_TRAIT_COUNT];
+    stats.genome.list_stat_traits(stats_traits);
+    stats.age = (unsigned)(age / count);
+    for (unsigned i = 0; i < Genome::STAT_TRAIT_COUNT; ++i) {
+        *stats_traits[i] = (float)(traits[i] / count);
+    }
+}
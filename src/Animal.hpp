@@ -3,6 +3,7 @@
 
 #include "Random.hpp"
 #include "Vec2D.hpp"
+#include <stdint.h>
 #include <stdio.h>
 
 namespace anosmellya {
@@ -21,50 +22,36 @@ struct SmellAffinity {
     SmellAffinity& operator=(SmellAffinity const& copy) = default;
 };
 
-struct Animal {
-    // Construct an animal with all zeroes.
-    Animal();
+// The inherited traits of an animal. These never change over an animal's life,
+// so they are kept apart from the animal itself.
+struct Genome {
+    // Construct a genome with all zeroes.
+    Genome();
 
-    Animal& operator=(Animal const& copy) = default;
+    Genome& operator=(Genome const& copy) = default;
 
-    // Construct an animal with a random mix of traits from the mother and
-    // father. The new animal has the position and velocity of the mother. Its
-    // starting food is the minimum of the mother's food and the mother's baby
-    // food, or zero if the quantity would otherwise be negative. No food is
-    // taken from the mother. The child is never a mutant.
-    Animal(Random& random, Animal const& mother, Animal const& father);
+    // Construct a genome with a random mix of traits from the mother and
+    // father. The genome is never a mutant.
+    Genome(Random& random, Genome const& mother, Genome const& father);
 
-    // Initialize an animal to be a decent starting carnivore. The position must
-    // be set after this.
+    // Initialize a genome to be that of a decent starting carnivore.
     void be_carn();
 
-    // Initialize an animal to be a decent starting herbivore. The position must
-    // be set after this.
+    // Initialize a genome to be that of a decent starting herbivore.
     void be_herb();
 
     // Mutate all traits by a quantity between -amount and +amount.
     void mutate(Random& random, float amount);
 
-    // Add all statistically relevant traits of this animal and the other.
-    void add(Animal const& an);
+    // The number of traits that statistics are kept on.
+    static const unsigned STAT_TRAIT_COUNT = 38;
 
-    // Divide all statistically relevant traits of this animal by the positive
-    // divisor d.
-    void divide(float d);
+    // Get pointers to the traits that statistics are kept on, always in the
+    // same order.
+    void list_stat_traits(float* traits[STAT_TRAIT_COUNT]);
 
-    // Print all statistically relevant traits to the file.
-    void print(FILE* to);
+    void list_stat_traits(float const* traits[STAT_TRAIT_COUNT]) const;
 
-    /* INDIVIDUAL ATTRIBUTES */
-    Vec2D pos;
-    Vec2D vel;
-    float food;
-    unsigned age;
-    // Whether there is a living animal in this animal's place.
-    bool is_present;
-    // Whether the animal was moved this tick already.
-    bool just_moved;
-    /* GENETICS */
     bool is_carn;
     float baby_smell_amount;
     float baby_threshold;
@@ -76,6 +63,73 @@ struct Animal {
     SmellAffinity vel_aff;
 };
 
+// The state of a living animal. This is what moves around the world, so it is
+// kept small. The genetics are in a genome pool.
+struct Animal {
+    // Construct an animal with all zeroes.
+    Animal();
+
+    Animal& operator=(Animal const& copy) = default;
+
+    // Construct a newborn animal with the genome at the index, which has the
+    // given traits.
+    Animal(unsigned genome, Genome const& traits, Vec2D pos, Vec2D vel,
+        float food);
+
+    Vec2D pos;
+    Vec2D vel;
+    float food;
+    unsigned age;
+    // The index of the animal's genome in the pool.
+    unsigned genome;
+    // Copied from the genome, since they are needed so often:
+    float baby_threshold;
+    bool is_carn;
+    // Whether the animal was moved this tick already.
+    bool just_moved;
+};
+
+// The statistically relevant traits of some animals, averaged.
+struct AnimalStats {
+    // Construct statistics with all zeroes.
+    AnimalStats();
+
+    AnimalStats& operator=(AnimalStats const& copy) = default;
+
+    // Print all traits to the file.
+    void print(FILE* to);
+
+    unsigned age;
+    Genome genome;
+};
+
+// Running totals of the statistically relevant traits of some animals. Animals
+// are added when born and taken away when they die, so the totals are kept in
+// double precision to stop them drifting away from the real sums. Totals can
+// also hold changes to be added to other totals, so the fields are signed.
+struct AnimalTotals {
+    // Construct totals with all zeroes.
+    AnimalTotals();
+
+    AnimalTotals& operator=(AnimalTotals const& copy) = default;
+
+    // Add the traits of an animal with the genome.
+    void add(Animal const& an, Genome const& genome);
+
+    // Take away the traits of an animal with the genome.
+    void remove(Animal const& an, Genome const& genome);
+
+    // Add other totals to these ones.
+    void add(AnimalTotals const& other);
+
+    // Put the averages of the traits into stats.
+    void average(AnimalStats& stats) const;
+
+    int64_t count;
+    int64_t age;
+    double traits[Genome::STAT_TRAIT_COUNT];
+};
+
 } /* namespace anosmellya */
 
 #endif /* ANOSMELLYA_ANIMAL_H_ */
@@ -0,0 +1,228 @@
+#include "BinaryStats.hpp"
+#include <string.h>
+
+using namespace anosmellya;
+
+#define MAGIC "ANOSTATS"
+// Bumped whenever the columns change; version 2 added skipped_fraction.
+#define VERSION_BYTE 2
+
+enum ColumnType { U32, U64, F32 };
+
+struct Column {
+    ColumnType type;
+    void* value;
+};
+
+// The most columns there can be: world_width, world_height, tick, the counts,
+// the totals, skipped_fraction, and the age and traits of each average animal.
+#define MAX_COLUMNS (3 + 2 + 4 + 1 + 2 * (1 + Genome::STAT_TRAIT_COUNT))
+
+static void list_animal_columns(AnimalStats& avg, Column*& at)
+{
+    Column age = { U32, &avg.age };
+    *at++ = age;
+    float* traits[Genome::STAT_TRAIT_COUNT];
+    avg.genome.list_stat_traits(traits);
+    for (unsigned i = 0; i < Genome::STAT_TRAIT_COUNT; ++i) {
+        Column trait = { F32, traits[i] };
+        *at++ = trait;
+    }
+}
+
+// Get the columns of the statistics in order, returning how many there are.
+static unsigned list_columns(Statistics& stats, Column columns[MAX_COLUMNS])
+{
+    Column* at = columns;
+    Column head[] = { { U32, &stats.world_width }, { U32, &stats.world_height },
+        { U64, &stats.tick } };
+    for (unsigned i = 0; i < 3; ++i) {
+        *at++ = head[i];
+    }
+    list_animal_columns(stats.herb_avg, at);
+    Column herb_count = { U32, &stats.herb_count };
+    *at++ = herb_count;
+    list_animal_columns(stats.carn_avg, at);
+    Column carn_count = { U32, &stats.carn_count };
+    *at++ = carn_count;
+    Column totals[] = { { F32, &stats.plant_total }, { F32, &stats.herb_total },
+        { F32, &stats.carn_total }, { F32, &stats.baby_total } };
+    for (unsigned i = 0; i < 4; ++i) {
+        *at++ = totals[i];
+    }
+    Column skipped_fraction = { F32, &stats.skipped_fraction };
+    *at++ = skipped_fraction;
+    return at - columns;
+}
+
+static uint64_t get_bits(Column const& column)
+{
+    switch (column.type) {
+    case U32:
+        return *(uint32_t*)column.value;
+    case U64:
+        return *(uint64_t*)column.value;
+    default: {
+        uint32_t bits;
+        memcpy(&bits, column.value, sizeof(bits));
+        return bits;
+    }
+    }
+}
+
+static void set_bits(Column const& column, uint64_t bits)
+{
+    switch (column.type) {
+    case U32:
+        *(uint32_t*)column.value = (uint32_t)bits;
+        break;
+    case U64:
+        *(uint64_t*)column.value = bits;
+        break;
+    default: {
+        uint32_t bits32 = (uint32_t)bits;
+        memcpy(column.value, &bits32, sizeof(bits32));
+        break;
+    }
+    }
+}
+
+static unsigned column_size(Column const& column)
+{
+    return column.type == U64 ? 8 : 4;
+}
+
+// The number of columns in every record, which the header records:
+static unsigned count_columns()
+{
+    Statistics stats;
+    Column columns[MAX_COLUMNS];
+    return list_columns(stats, columns);
+}
+
+BinaryStats::BinaryStats(Encoding encoding)
+    : encoding(encoding)
+    , prev(count_columns(), 0)
+{
+}
+
+void BinaryStats::write_header(FILE* to)
+{
+    unsigned count = prev.size();
+    uint8_t header[] = { VERSION_BYTE, (uint8_t)encoding, (uint8_t)count,
+        (uint8_t)(count >> 8) };
+    fwrite(MAGIC, 1, strlen(MAGIC), to);
+    fwrite(header, 1, sizeof(header), to);
+}
+
+void BinaryStats::write(FILE* to, Statistics const& stats)
+{
+    Statistics copy = stats;
+    Column columns[MAX_COLUMNS];
+    unsigned count = list_columns(copy, columns);
+    // The largest a record can be is 10 LEB128 bytes per column:
+    uint8_t buf[MAX_COLUMNS * 10];
+    uint8_t* at = buf;
+    for (unsigned i = 0; i < count; ++i) {
+        uint64_t bits = get_bits(columns[i]);
+        if (encoding == DELTA) {
+            uint64_t change;
+            if (columns[i].type == F32) {
+                change = bits ^ prev[i];
+            } else {
+                int64_t diff = (int64_t)(bits - prev[i]);
+                change = ((uint64_t)diff << 1) ^ (uint64_t)(diff >> 63);
+            }
+            prev[i] = bits;
+            do {
+                uint8_t byte = change & 0x7F;
+                change >>= 7;
+                *at++ = change ? byte | 0x80 : byte;
+            } while (change);
+        } else {
+            for (unsigned b = 0; b < column_size(columns[i]); ++b) {
+                *at++ = (uint8_t)(bits >> (8 * b));
+            }
+        }
+    }
+    fwrite(buf, 1, at - buf, to);
+}
+
+int BinaryStats::read_header(FILE* from)
+{
+    char magic[sizeof(MAGIC) - 1];
+    uint8_t header[4];
+    if (fread(magic, 1, sizeof(magic), from) != sizeof(magic)
+        || memcmp(magic, MAGIC, sizeof(magic))
+        || fread(header, 1, sizeof(header), from) != sizeof(header)
+        || header[0] != VERSION_BYTE || header[1] > DELTA
+        || (header[2] | (unsigned)header[3] << 8) != prev.size()) {
+        return -1;
+    }
+    encoding = (Encoding)header[1];
+    for (unsigned i = 0; i < prev.size(); ++i) {
+        prev[i] = 0;
+    }
+    return 0;
+}
+
+int BinaryStats::read(FILE* from, Statistics& stats)
+{
+    Column columns[MAX_COLUMNS];
+    unsigned count = list_columns(stats, columns);
+    for (unsigned i = 0; i < count; ++i) {
+        uint64_t bits = 0;
+        if (encoding == DELTA) {
+            uint64_t change = 0;
+            int byte;
+            unsigned shift = 0;
+            do {
+                byte = getc(from);
+                if (byte == EOF || shift >= 64) {
+                    return i == 0 && byte == EOF && shift == 0 ? 0 : -1;
+                }
+                change |= (uint64_t)(byte & 0x7F) << shift;
+                shift += 7;
+            } while (byte & 0x80);
+            if (columns[i].type == F32) {
+                bits = prev[i] ^ change;
+            } else {
+                int64_t diff = (int64_t)(change >> 1) ^ -(int64_t)(change & 1);
+                bits = prev[i] + (uint64_t)diff;
+            }
+            prev[i] = bits;
+        } else {
+            for (unsigned b = 0; b < column_size(columns[i]); ++b) {
+                int byte = getc(from);
+                if (byte == EOF) {
+                    return i == 0 && b == 0 ? 0 : -1;
+                }
+                bits |= (uint64_t)byte << (8 * b);
+            }
+        }
+        set_bits(columns[i], bits);
+    }
+    return 1;
+}
+
+int BinaryStats::convert_to_json(FILE* from, FILE* to)
+{
+    BinaryStats reader(PLAIN);
+    // The header is only written with the first record, so an empty file
+    // just has no records:
+    int first = fgetc(from);
+    if (first == EOF) {
+        return ferror(from) ? -1 : 0;
+    }
+    ungetc(first, from);
+    if (reader.read_header(from) < 0) {
+        return -1;
+    }
+    Statistics stats;
+    int status;
+    while ((status = reader.read(from, stats)) > 0) {
+        stats.print(to);
+        fputc('\n', to);
+    }
+    return status;
+}
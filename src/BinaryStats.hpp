@@ -0,0 +1,54 @@
+#ifndef ANOSMELLYA_BINARY_STATS_H_
+#define ANOSMELLYA_BINARY_STATS_H_
+
+#include "World.hpp"
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+namespace anosmellya {
+
+// A compact binary encoding of statistics. A file with records starts with a
+// header, which is the magic bytes "ANOSTATS", a version byte, an encoding
+// byte, and the number of columns as a little-endian 16-bit integer. Then come
+// the records, each a fixed list of columns, one for each number in Statistics
+// in the order that Statistics::print prints them. A file with no records is
+// empty.
+//
+// In the plain encoding, each column is a little-endian integer or float of
+// its natural size. In the delta encoding, each column is instead a LEB128
+// variable-length integer of the change from the same column of the previous
+// record: the zigzagged difference for integers, or the XOR of the bits for
+// floats. Columns that change slowly then only take a byte or two.
+class BinaryStats {
+public:
+    enum Encoding { PLAIN = 0, DELTA = 1 };
+
+    BinaryStats(Encoding encoding);
+
+    // Write the header of a new file to the file.
+    void write_header(FILE* to);
+
+    // Append a record to the file.
+    void write(FILE* to, Statistics const& stats);
+
+    // Read the header from the file. Returns -1 if it's not a valid header.
+    int read_header(FILE* from);
+
+    // Read a record from the file into stats. Returns 0 at the end of the
+    // file, 1 if a record was read, or -1 on an error.
+    int read(FILE* from, Statistics& stats);
+
+    // Convert binary statistics to JSON lines like those printed normally. An
+    // empty file has no records. Returns -1 on failure.
+    static int convert_to_json(FILE* from, FILE* to);
+
+private:
+    Encoding encoding;
+    // The columns of the previous record, for the delta encoding:
+    std::vector<uint64_t> prev;
+};
+
+} /* namespace anosmellya */
+
+#endif /* ANOSMELLYA_BINARY_STATS_H_ */
@@ -0,0 +1,420 @@
+#include "Checkpoint.hpp"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace anosmellya;
+
+static const char MAGIC[8] = { 'A', 'N', 'O', 'C', 'K', 'P', 'T', '\0' };
+
+// Written in native byte order, so it reads differently on other machines:
+#define BYTE_ORDER_MARK 0x01020304
+
+// Blocks start on multiples of this many bytes:
+#define BLOCK_ALIGN 64
+
+// The number of tiles in a run of the animal grid that is skipped when no
+// animals are in it:
+#define EMPTY_RUN_TILES 1024
+
+static size_t align_block(size_t offset)
+{
+    return (offset + BLOCK_ALIGN - 1) / BLOCK_ALIGN * BLOCK_ALIGN;
+}
+
+Checkpoint::Checkpoint()
+    : data(NULL)
+    , size(0)
+    , mapped(false)
+    , offsets()
+{
+}
+
+Checkpoint::~Checkpoint() { close(); }
+
+void Checkpoint::find_blocks(
+    Header const& header, size_t offsets[BLOCK_COUNT + 1])
+{
+    size_t width = header.width;
+    size_t height = header.height;
+    size_t sizes[BLOCK_COUNT];
+    sizes[BLOCK_ANIMALS]
+        = (size_t)Grid<Animal>::stride_for(width, 0) * height * sizeof(Animal);
+    sizes[BLOCK_OCCUPANCY] = (width + 63) / 64 * height * sizeof(uint64_t);
+    sizes[BLOCK_GENOMES] = header.genomes_used * sizeof(Genome);
+    sizes[BLOCK_FREE_GENOMES] = header.genomes_free * sizeof(uint32_t);
+    sizes[BLOCK_FLUID_TOTALS] = 4 * (1 + height) * sizeof(double);
+    // Fluid grids have ghosts one tile wide:
+    size_t fluid_size = header.flags & FLAG_HALF_FLUIDS
+        ? (size_t)Grid<uint16_t>::stride_for(width, 1) * (height + 2)
+            * sizeof(uint16_t)
+        : (size_t)Grid<float>::stride_for(width, 1) * (height + 2)
+            * sizeof(float);
+    size_t gradient_size = header.flags & FLAG_GRADIENT_FIELDS
+        ? 2 * width * height * sizeof(float)
+        : 0;
+    size_t max_size = (width + FLUID_BLOCK_COLS - 1) / FLUID_BLOCK_COLS
+        * height * sizeof(float);
+    for (unsigned i = 0; i < 4; ++i) {
+        sizes[BLOCK_PLANT + i] = fluid_size;
+        sizes[BLOCK_PLANT_GRADIENT + i] = gradient_size;
+        sizes[BLOCK_PLANT_MAX + i] = max_size;
+    }
+    size_t offset = sizeof(Header);
+    for (unsigned i = 0; i < BLOCK_COUNT; ++i) {
+        offset = align_block(offset);
+        offsets[i] = offset;
+        offset += sizes[i];
+    }
+    offsets[BLOCK_COUNT] = offset;
+}
+
+// Write the bytes at the offset. Small gaps before it are filled with zeroes,
+// and larger ones are skipped over, which leaves a hole where possible.
+static bool write_at(
+    FILE* to, size_t& pos, size_t offset, void const* bytes, size_t len)
+{
+    static const char zeroes[BLOCK_ALIGN] = { 0 };
+    size_t gap = offset - pos;
+    if (gap > 0 && gap < BLOCK_ALIGN) {
+        if (fwrite(zeroes, 1, gap, to) != gap) {
+            return false;
+        }
+    } else if (gap > 0 && fseek(to, gap, SEEK_CUR)) {
+        return false;
+    }
+    pos = offset + len;
+    return fwrite(bytes, 1, len, to) == len;
+}
+
+bool Checkpoint::write_file(World& world, FILE* to)
+{
+    Header header;
+    // Clear the padding too, so that it isn't saved as garbage:
+    memset((void*)&header, 0, sizeof(header));
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = FORMAT_VERSION;
+    header.byte_order = BYTE_ORDER_MARK;
+    header.header_size = sizeof(Header);
+    header.animal_size = sizeof(Animal);
+    header.genome_size = sizeof(Genome);
+    header.config_size = sizeof(Config);
+    header.totals_size = sizeof(AnimalTotals);
+    header.width = world.get_width();
+    header.height = world.get_height();
+    header.seed = world.seed;
+    header.flags = (world.reference_fluids ? FLAG_REFERENCE_FLUIDS : 0)
+        | (world.plant.has_gradient() ? FLAG_GRADIENT_FIELDS : 0)
+        | (world.plant.is_half() ? FLAG_HALF_FLUIDS : 0);
+    header.tick = world.tick;
+    header.genomes_used = world.genomes.used;
+    header.genomes_free = world.genomes.free_list.size();
+    header.conf = world.conf;
+    header.herb_totals = world.herb_totals;
+    header.carn_totals = world.carn_totals;
+    size_t offsets[BLOCK_COUNT + 1];
+    find_blocks(header, offsets);
+    size_t pos = 0;
+    if (!write_at(to, pos, 0, &header, sizeof(header))) {
+        return false;
+    }
+    // The animal grid is mostly empty, so runs of it with no animals are
+    // skipped. What's in empty tiles doesn't matter.
+    unsigned width = header.width;
+    size_t stride = world.animal.get_stride();
+    for (unsigned y = 0; y < header.height; ++y) {
+        for (unsigned x = 0; x < width; x += EMPTY_RUN_TILES) {
+            unsigned end = x + EMPTY_RUN_TILES < width ? x + EMPTY_RUN_TILES
+                                                       : width;
+            if (world.occupied.next(x, y) >= end) {
+                continue;
+            }
+            size_t offset = offsets[BLOCK_ANIMALS]
+                + (y * stride + x) * sizeof(Animal);
+            if (!write_at(to, pos, offset, &world.animal.at(x, y),
+                    (end - x) * sizeof(Animal))) {
+                return false;
+            }
+        }
+    }
+    std::vector<uint64_t>& bits = world.occupied.get_bits();
+    if (!write_at(to, pos, offsets[BLOCK_OCCUPANCY], bits.data(),
+            bits.size() * sizeof(uint64_t))) {
+        return false;
+    }
+    // The genomes are in blocks of the pool, but go in the file as one:
+    GenomePool& genomes = world.genomes;
+    for (unsigned i = 0; i < genomes.used; i += GenomePool::BLOCK_SIZE) {
+        unsigned count = genomes.used - i < GenomePool::BLOCK_SIZE
+            ? genomes.used - i
+            : GenomePool::BLOCK_SIZE;
+        if (!write_at(to, pos, offsets[BLOCK_GENOMES] + i * sizeof(Genome),
+                genomes.blocks[i / GenomePool::BLOCK_SIZE],
+                count * sizeof(Genome))) {
+            return false;
+        }
+    }
+    if (!write_at(to, pos, offsets[BLOCK_FREE_GENOMES],
+            genomes.free_list.data(),
+            genomes.free_list.size() * sizeof(uint32_t))) {
+        return false;
+    }
+    Fluid* fluids[] = { &world.plant, &world.herb, &world.carn, &world.baby };
+    // The fluid totals follow one another in a single block:
+    size_t totals_offset = offsets[BLOCK_FLUID_TOTALS];
+    for (unsigned i = 0; i < 4; ++i) {
+        Fluid& fluid = *fluids[i];
+        if (!write_at(to, pos, totals_offset, &fluid.total, sizeof(double))
+            || !write_at(to, pos, pos, fluid.row_totals.data(),
+                fluid.row_totals.size() * sizeof(double))) {
+            return false;
+        }
+        totals_offset = pos;
+    }
+    for (unsigned i = 0; i < 4; ++i) {
+        size_t tiles_size;
+        void* tiles = fluid_tiles(*fluids[i], tiles_size);
+        if (!write_at(to, pos, offsets[BLOCK_PLANT + i], tiles, tiles_size)) {
+            return false;
+        }
+    }
+    for (unsigned i = 0; i < 4; ++i) {
+        Fluid& fluid = *fluids[i];
+        size_t offset = offsets[BLOCK_PLANT_GRADIENT + i];
+        if (!write_at(to, pos, offset, fluid.grad_x.data(),
+                fluid.grad_x.size() * sizeof(float))
+            || !write_at(to, pos, pos, fluid.grad_y.data(),
+                fluid.grad_y.size() * sizeof(float))) {
+            return false;
+        }
+    }
+    for (unsigned i = 0; i < 4; ++i) {
+        Fluid& fluid = *fluids[i];
+        if (!write_at(to, pos, offsets[BLOCK_PLANT_MAX + i],
+                fluid.grid_max.data(),
+                fluid.grid_max.size() * sizeof(float))) {
+            return false;
+        }
+    }
+    // Make sure the file is as long as it should be, even if it ends in skipped
+    // space:
+    static const char zero = 0;
+    size_t end = offsets[BLOCK_COUNT];
+    return pos == end || write_at(to, pos, end - 1, &zero, 1);
+}
+
+void* Checkpoint::fluid_tiles(Fluid& fluid, size_t& size)
+{
+    if (fluid.half) {
+        size = fluid.half_grid.tile_count() * sizeof(uint16_t);
+        return fluid.half_grid.get_tiles();
+    }
+    size = fluid.grid.tile_count() * sizeof(float);
+    return fluid.grid.get_tiles();
+}
+
+bool Checkpoint::save(World& world, const char* path)
+{
+    size_t path_len = strlen(path);
+    std::vector<char> tmp_path(path_len + 5);
+    memcpy(tmp_path.data(), path, path_len);
+    memcpy(tmp_path.data() + path_len, ".tmp", 5);
+    FILE* to = fopen(tmp_path.data(), "wb");
+    if (!to) {
+        return false;
+    }
+    bool ok = write_file(world, to) && fflush(to) == 0;
+#ifndef _WIN32
+    // Make sure the data is on disk before the rename is:
+    ok = ok && fsync(fileno(to)) == 0;
+#endif
+    int saved_errno = errno;
+    if (fclose(to) != 0 && ok) {
+        ok = false;
+        saved_errno = errno;
+    }
+    if (ok) {
+#ifdef _WIN32
+        ok = MoveFileExA(tmp_path.data(), path,
+            MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+        saved_errno = EIO;
+#else
+        ok = rename(tmp_path.data(), path) == 0;
+        saved_errno = errno;
+#endif
+    }
+    if (!ok) {
+        remove(tmp_path.data());
+        errno = saved_errno;
+    }
+    return ok;
+}
+
+bool Checkpoint::open(const char* path)
+{
+    close();
+#ifdef _WIN32
+    // Without mmap, the file is read whole:
+    FILE* from = fopen(path, "rb");
+    if (!from) {
+        fprintf(stderr, "Unable to open checkpoint '%s'; %s\n", path,
+            strerror(errno));
+        return false;
+    }
+    fseek(from, 0, SEEK_END);
+    long len = ftell(from);
+    fseek(from, 0, SEEK_SET);
+    unsigned char* bytes = len > 0 ? (unsigned char*)malloc(len) : NULL;
+    if (!bytes || fread(bytes, 1, len, from) != (size_t)len) {
+        fprintf(stderr, "Unable to read checkpoint '%s'\n", path);
+        free(bytes);
+        fclose(from);
+        return false;
+    }
+    fclose(from);
+    data = bytes;
+    size = len;
+    mapped = false;
+#else
+    int fd = ::open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Unable to open checkpoint '%s'; %s\n", path,
+            strerror(errno));
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return false;
+    }
+    void* map = st.st_size > 0
+        ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)
+        : MAP_FAILED;
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Unable to map checkpoint '%s'; %s\n", path,
+            strerror(errno));
+        return false;
+    }
+    // The blocks are copied out front to back:
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    data = (unsigned char const*)map;
+    size = st.st_size;
+    mapped = true;
+#endif
+    Header const* header = (Header const*)data;
+    if (size < sizeof(Header) || memcmp(header->magic, MAGIC, sizeof(MAGIC))) {
+        fprintf(stderr, "'%s' is not a checkpoint\n", path);
+    } else if (header->version != FORMAT_VERSION) {
+        fprintf(stderr, "Checkpoint '%s' has unsupported version %u\n", path,
+            (unsigned)header->version);
+    } else if (header->byte_order != BYTE_ORDER_MARK
+        || header->header_size != sizeof(Header)
+        || header->animal_size != sizeof(Animal)
+        || header->genome_size != sizeof(Genome)
+        || header->config_size != sizeof(Config)
+        || header->totals_size != sizeof(AnimalTotals)) {
+        fprintf(stderr, "Checkpoint '%s' was saved by an incompatible build\n",
+            path);
+    } else if (header->width == 0 || header->height == 0
+        || header->genomes_used > (uint64_t)header->width * header->height
+        || header->genomes_free > header->genomes_used) {
+        fprintf(stderr, "Checkpoint '%s' is corrupt\n", path);
+    } else {
+        find_blocks(*header, offsets);
+        if (offsets[BLOCK_COUNT] == size) {
+            return true;
+        }
+        fprintf(stderr, "Checkpoint '%s' is truncated or corrupt\n", path);
+    }
+    close();
+    return false;
+}
+
+void Checkpoint::close()
+{
+    if (!data) {
+        return;
+    }
+#ifdef _WIN32
+    free((void*)data);
+#else
+    if (mapped) {
+        munmap((void*)data, size);
+    }
+#endif
+    data = NULL;
+    size = 0;
+}
+
+void Checkpoint::apply_options(Options& opts)
+{
+    Header const* header = (Header const*)data;
+    opts.world_width = header->width;
+    opts.world_height = header->height;
+    opts.seed = header->seed;
+    opts.conf = header->conf;
+    opts.reference_fluids = header->flags & FLAG_REFERENCE_FLUIDS;
+    opts.gradient_fields = header->flags & FLAG_GRADIENT_FIELDS;
+    opts.half_fluids = header->flags & FLAG_HALF_FLUIDS;
+}
+
+void Checkpoint::restore(World& world)
+{
+    Header const* header = (Header const*)data;
+    world.tick = header->tick;
+    world.herb_totals = header->herb_totals;
+    world.carn_totals = header->carn_totals;
+    memcpy(world.animal.get_tiles(), data + offsets[BLOCK_ANIMALS],
+        world.animal.tile_count() * sizeof(Animal));
+    std::vector<uint64_t>& bits = world.occupied.get_bits();
+    memcpy(bits.data(), data + offsets[BLOCK_OCCUPANCY],
+        bits.size() * sizeof(uint64_t));
+    // Replace whatever genomes the world started with:
+    GenomePool& genomes = world.genomes;
+    Genome const* saved_genomes
+        = (Genome const*)(data + offsets[BLOCK_GENOMES]);
+    for (unsigned i = 0; i < header->genomes_used;
+         i += GenomePool::BLOCK_SIZE) {
+        unsigned count = header->genomes_used - i < GenomePool::BLOCK_SIZE
+            ? header->genomes_used - i
+            : GenomePool::BLOCK_SIZE;
+        Genome*& block = genomes.blocks[i / GenomePool::BLOCK_SIZE];
+        if (!block) {
+            block = new Genome[GenomePool::BLOCK_SIZE];
+        }
+        memcpy(block, saved_genomes + i, count * sizeof(Genome));
+    }
+    genomes.used = header->genomes_used;
+    uint32_t const* free_list
+        = (uint32_t const*)(data + offsets[BLOCK_FREE_GENOMES]);
+    genomes.free_list.assign(free_list, free_list + header->genomes_free);
+    Fluid* fluids[] = { &world.plant, &world.herb, &world.carn, &world.baby };
+    double const* totals
+        = (double const*)(data + offsets[BLOCK_FLUID_TOTALS]);
+    for (unsigned i = 0; i < 4; ++i) {
+        Fluid& fluid = *fluids[i];
+        fluid.total = *totals++;
+        fluid.row_totals.assign(totals, totals + header->height);
+        totals += header->height;
+        size_t tiles_size;
+        void* tiles = fluid_tiles(fluid, tiles_size);
+        memcpy(tiles, data + offsets[BLOCK_PLANT + i], tiles_size);
+        float const* gradient
+            = (float const*)(data + offsets[BLOCK_PLANT_GRADIENT + i]);
+        size_t area = fluid.grad_x.size();
+        fluid.grad_x.assign(gradient, gradient + area);
+        fluid.grad_y.assign(gradient + area, gradient + 2 * area);
+        float const* maxes
+            = (float const*)(data + offsets[BLOCK_PLANT_MAX + i]);
+        fluid.grid_max.assign(maxes, maxes + fluid.grid_max.size());
+    }
+    close();
+}
@@ -33,6 +33,7 @@ Config::Config()
     , plant_evap(0.001)
     , plant_place_amount(1000.)
     , plant_place_chance(0.00007)
+    , skip_threshold(0.)
 {
 }
 
@@ -100,6 +101,8 @@ static bool set_option(Config& conf, std::string& key, float val)
         conf.plant_place_amount = val;
     } else if (key == "plant_place_chance") {
         conf.plant_place_chance = val;
+    } else if (key == "skip_threshold") {
+        conf.skip_threshold = val;
     } else {
         return false;
     }
@@ -38,6 +38,7 @@ public:
     float plant_evap;
     float plant_place_amount;
     float plant_place_chance;
+    float skip_threshold;
 };
 
 } /* namespace anosmellya */
@@ -0,0 +1,186 @@
+#include "Drawer.hpp"
+#include <math.h>
+
+using namespace anosmellya;
+
+Drawer::Drawer(SDL_Renderer* renderer)
+    : renderer(renderer)
+    , smell_texture(NULL)
+    , texture_width(0)
+    , texture_height(0)
+    , rect_buf()
+    , line_bufs()
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    , line_vertices()
+    , line_indices()
+#endif
+{
+}
+
+Drawer::~Drawer()
+{
+    if (smell_texture) {
+        SDL_DestroyTexture(smell_texture);
+    }
+}
+
+void Drawer::make_smell_texture(unsigned width, unsigned height)
+{
+    if (width == texture_width && height == texture_height) {
+        return;
+    }
+    if (smell_texture) {
+        SDL_DestroyTexture(smell_texture);
+    }
+    // If this fails, it isn't tried again until the size changes:
+    smell_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+        SDL_TEXTUREACCESS_STREAMING, width, height);
+    texture_width = width;
+    texture_height = height;
+}
+
+void Drawer::draw_smells(Snapshot const& snap)
+{
+    make_smell_texture(snap.width, snap.height);
+    if (!smell_texture) {
+        draw_smell_tiles(snap);
+        return;
+    }
+    SDL_UpdateTexture(smell_texture, NULL, snap.smell_pixels.data(),
+        snap.width * sizeof(uint32_t));
+    SDL_Rect viewport;
+    SDL_RenderGetViewport(renderer, &viewport);
+    SDL_Rect dst;
+    dst.x = 0;
+    dst.y = 0;
+    dst.w = viewport.w / snap.width * snap.width;
+    dst.h = viewport.h / snap.height * snap.height;
+    SDL_RenderCopy(renderer, smell_texture, NULL, &dst);
+}
+
+void Drawer::draw_smell_tiles(Snapshot const& snap)
+{
+    SDL_Rect viewport;
+    SDL_RenderGetViewport(renderer, &viewport);
+    SDL_Rect tile;
+    tile.w = viewport.w / snap.width;
+    tile.h = viewport.h / snap.height;
+    for (unsigned y = 0; y < snap.height; ++y) {
+        for (unsigned x = 0; x < snap.width; ++x) {
+            uint32_t pixel = snap.smell_pixels[y * snap.width + x];
+            tile.x = (int)x * tile.w;
+            tile.y = (int)y * tile.h;
+            SDL_SetRenderDrawColor(renderer, pixel >> 16 & 0xFF,
+                pixel >> 8 & 0xFF, pixel & 0xFF, 255);
+            SDL_RenderFillRect(renderer, &tile);
+        }
+    }
+}
+
+void Drawer::draw_affs(Snapshot const& snap)
+{
+    static const Uint8 colors[][3] = { { 0, 200, 0 }, { 0, 0, 200 },
+        { 200, 0, 0 }, { 200, 0, 200 }, { 200, 200, 200 } };
+    SDL_Rect viewport;
+    SDL_RenderGetViewport(renderer, &viewport);
+    int tw = viewport.w / snap.width;
+    int th = viewport.h / snap.height;
+    for (unsigned i = 0; i < snap.affs.size(); ++i) {
+        AffVectors const& aff = snap.affs[i];
+        SDL_Point start;
+        start.x = aff.pos.x * tw;
+        start.y = aff.pos.y * th;
+        for (unsigned j = 0; j < 5; ++j) {
+            SDL_Point end;
+            end.x = start.x + (int)(aff.accs[j].x * tw);
+            end.y = start.y + (int)(aff.accs[j].y * th);
+            // Lines shorter than a pixel aren't worth drawing:
+            if (end.x != start.x || end.y != start.y) {
+                line_bufs[j].push_back(start);
+                line_bufs[j].push_back(end);
+            }
+        }
+    }
+    for (unsigned j = 0; j < 5; ++j) {
+        draw_lines(line_bufs[j], colors[j]);
+        line_bufs[j].clear();
+    }
+}
+
+void Drawer::draw_lines(
+    std::vector<SDL_Point> const& ends, Uint8 const color[3])
+{
+    if (ends.empty()) {
+        return;
+    }
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    SDL_Vertex vertex;
+    vertex.color.r = color[0];
+    vertex.color.g = color[1];
+    vertex.color.b = color[2];
+    vertex.color.a = 255;
+    vertex.tex_coord.x = 0.;
+    vertex.tex_coord.y = 0.;
+    for (unsigned i = 0; i + 1 < ends.size(); i += 2) {
+        // Go through pixel centers, half a pixel to each side of the line:
+        float x1 = ends[i].x + 0.5;
+        float y1 = ends[i].y + 0.5;
+        float x2 = ends[i + 1].x + 0.5;
+        float y2 = ends[i + 1].y + 0.5;
+        float scale = 0.5 / hypotf(x2 - x1, y2 - y1);
+        float nx = (y1 - y2) * scale;
+        float ny = (x2 - x1) * scale;
+        int first = line_vertices.size();
+        vertex.position.x = x1 + nx;
+        vertex.position.y = y1 + ny;
+        line_vertices.push_back(vertex);
+        vertex.position.x = x1 - nx;
+        vertex.position.y = y1 - ny;
+        line_vertices.push_back(vertex);
+        vertex.position.x = x2 + nx;
+        vertex.position.y = y2 + ny;
+        line_vertices.push_back(vertex);
+        vertex.position.x = x2 - nx;
+        vertex.position.y = y2 - ny;
+        line_vertices.push_back(vertex);
+        static const int quad[] = { 0, 1, 2, 1, 3, 2 };
+        for (unsigned j = 0; j < 6; ++j) {
+            line_indices.push_back(first + quad[j]);
+        }
+    }
+    int failed = SDL_RenderGeometry(renderer, NULL, line_vertices.data(),
+        line_vertices.size(), line_indices.data(), line_indices.size());
+    line_vertices.clear();
+    line_indices.clear();
+    if (!failed) {
+        return;
+    }
+#endif
+    // Without geometry, at least the color only needs to be set once:
+    SDL_SetRenderDrawColor(renderer, color[0], color[1], color[2], 255);
+    for (unsigned i = 0; i + 1 < ends.size(); i += 2) {
+        SDL_RenderDrawLine(
+            renderer, ends[i].x, ends[i].y, ends[i + 1].x, ends[i + 1].y);
+    }
+}
+
+void Drawer::draw_animals(Snapshot const& snap)
+{
+    SDL_Rect viewport;
+    SDL_RenderGetViewport(renderer, &viewport);
+    SDL_Rect tile;
+    tile.w = viewport.w / snap.width;
+    tile.h = viewport.h / snap.height;
+    for (unsigned look = 0; look < LOOK_COUNT; ++look) {
+        std::vector<Vec2D> const& animals = snap.animals[look];
+        for (unsigned i = 0; i < animals.size(); ++i) {
+            tile.x = (animals[i].x - 0.5) * tile.w;
+            tile.y = (animals[i].y - 0.5) * tile.h;
+            rect_buf.push_back(tile);
+        }
+        SDL_SetRenderDrawColor(renderer, look_colors[look][0],
+            look_colors[look][1], look_colors[look][2], 255);
+        SDL_RenderFillRects(renderer, rect_buf.data(), rect_buf.size());
+        rect_buf.clear();
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef ANOSMELLYA_DRAWER_H_
+#define ANOSMELLYA_DRAWER_H_
+
+#include "Snapshot.hpp"
+#include <SDL2/SDL.h>
+#include <vector>
+
+namespace anosmellya {
+
+// Draws snapshots of the world with a renderer, scaled to fill its viewport
+// with whole pixels per tile. The smells are uploaded to a world-sized
+// streaming texture and drawn with one copy, unless the texture can't be made.
+class Drawer {
+public:
+    Drawer(SDL_Renderer* renderer);
+
+    ~Drawer();
+
+    void draw_smells(Snapshot const& snap);
+
+    void draw_affs(Snapshot const& snap);
+
+    void draw_animals(Snapshot const& snap);
+
+private:
+    Drawer(Drawer const& copy);
+    Drawer& operator=(Drawer const& copy);
+
+    // Make sure there's a smell texture of the size, if possible.
+    void make_smell_texture(unsigned width, unsigned height);
+
+    // Draw the smells with a rectangle per tile, for when there's no texture.
+    void draw_smell_tiles(Snapshot const& snap);
+
+    // Draw lines between each pair of points in the color.
+    void draw_lines(std::vector<SDL_Point> const& ends, Uint8 const color[3]);
+
+    SDL_Renderer* renderer;
+    SDL_Texture* smell_texture;
+    unsigned texture_width;
+    unsigned texture_height;
+    std::vector<SDL_Rect> rect_buf;
+    // The ends of the affinity lines of each color:
+    std::vector<SDL_Point> line_bufs[5];
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    // Lines are drawn as thin quads so that each color takes one call:
+    std::vector<SDL_Vertex> line_vertices;
+    std::vector<int> line_indices;
+#endif
+};
+
+} /* namespace anosmellya */
+
+#endif /* ANOSMELLYA_DRAWER_H_ */
@@ -0,0 +1,542 @@
+#include "Fluid.hpp"
+#include "simd.hpp"
+#include <math.h>
+
+using namespace anosmellya;
+
+// The number of vectors summed in single precision before the sum is added to a
+// double. This keeps row totals accurate without slowing the kernel down.
+#define SUM_BLOCK 16
+
+Fluid::Fluid(unsigned width, unsigned height, float dispersal, float evap,
+    bool gradient, float threshold, bool half)
+    : width(width)
+    , height(height)
+    , grid(half ? 0 : width, half ? 0 : height, 1,
+          &GridAllocator::get_default())
+    , next(half ? 0 : width, half ? 0 : height, 1,
+          &GridAllocator::get_default())
+    , half_grid(half ? width : 0, half ? height : 0, 1,
+          &GridAllocator::get_default())
+    , half_next(half ? width : 0, half ? height : 0, 1,
+          &GridAllocator::get_default())
+    , half(half)
+    , dispersal(dispersal)
+    , evap(evap)
+    , gradient(gradient)
+    , total(0.)
+    , row_totals(height, 0.)
+    , grad_x(gradient ? width * height : 0, 0.)
+    , grad_y(gradient ? width * height : 0, 0.)
+    , threshold(threshold)
+    , row_blocks((width + FLUID_BLOCK_COLS - 1) / FLUID_BLOCK_COLS)
+    , grid_max(height * row_blocks, 0.)
+    , next_max(height * row_blocks, 0.)
+    , row_skips(height, 0)
+    , skipped(0)
+{
+}
+
+void Fluid::clear_rows(unsigned start, unsigned end)
+{
+    if (half) {
+        half_grid.fill_rows(start, end, 0);
+        half_next.fill_rows(start, end, 0);
+    } else {
+        grid.fill_rows(start, end, 0.);
+        next.fill_rows(start, end, 0.);
+    }
+}
+
+// Exchange the given portion of the difference between each of count tiles
+// and its left and right neighbors, which must be there to read.
+static void disperse_span(
+    float const* src, float* dst, unsigned count, float portion)
+{
+    float center = 1. - 2. * portion;
+    unsigned x = 0;
+    SimdFloat v_center = simd_set(center);
+    SimdFloat v_portion = simd_set(portion);
+    for (; x + ANOSMELLYA_SIMD_WIDTH <= count; x += ANOSMELLYA_SIMD_WIDTH) {
+        SimdFloat sides
+            = simd_add(simd_load(src + x - 1), simd_load(src + x + 1));
+        simd_store(dst + x,
+            simd_add(simd_mul(simd_load(src + x), v_center),
+                simd_mul(sides, v_portion)));
+    }
+    for (; x < count; ++x) {
+        dst[x] = src[x] * center + (src[(int)x - 1] + src[x + 1]) * portion;
+    }
+}
+
+// Do disperse_span across a whole row. The source row must have ghost tiles.
+static void disperse_row(
+    float const* src, float* dst, unsigned width, float portion)
+{
+    if (width == 1) {
+        dst[0] = src[0];
+        return;
+    }
+    disperse_span(src, dst, width, portion);
+}
+
+// Do the same as disperse_row, but vertically between three horizontally
+// dispersed rows. The result is also scaled by keep for evaporation. The total
+// of the resulting row is returned.
+static double combine_rows(float const* above, float const* here,
+    float const* below, float* dst, unsigned width, float portion, float keep)
+{
+    float center = (1. - 2. * portion) * keep;
+    portion *= keep;
+    unsigned x = 0;
+    SimdFloat v_center = simd_set(center);
+    SimdFloat v_portion = simd_set(portion);
+    SimdFloat v_sum = simd_set(0.);
+    double sum = 0.;
+    unsigned summed = 0;
+    for (; x + ANOSMELLYA_SIMD_WIDTH <= width; x += ANOSMELLYA_SIMD_WIDTH) {
+        SimdFloat sides = simd_add(simd_load(above + x), simd_load(below + x));
+        SimdFloat result = simd_add(simd_mul(simd_load(here + x), v_center),
+            simd_mul(sides, v_portion));
+        simd_store(dst + x, result);
+        v_sum = simd_add(v_sum, result);
+        if (++summed == SUM_BLOCK) {
+            sum += simd_total(v_sum);
+            v_sum = simd_set(0.);
+            summed = 0;
+        }
+    }
+    sum += simd_total(v_sum);
+    for (; x < width; ++x) {
+        dst[x] = here[x] * center + (above[x] + below[x]) * portion;
+        sum += dst[x];
+    }
+    return sum;
+}
+
+// Find the difference between the neighbors of each tile of the middle row,
+// horizontally within the row and vertically between the rows above and below.
+// The middle row must have ghost tiles.
+static void gradient_row(float const* above, float const* here,
+    float const* below, float* dx, float* dy, unsigned width)
+{
+    unsigned x = 0;
+    for (; x + ANOSMELLYA_SIMD_WIDTH <= width; x += ANOSMELLYA_SIMD_WIDTH) {
+        simd_store(
+            dx + x, simd_sub(simd_load(here + x + 1), simd_load(here + x - 1)));
+    }
+    for (; x < width; ++x) {
+        dx[x] = here[x + 1] - here[(int)x - 1];
+    }
+    x = 0;
+    for (; x + ANOSMELLYA_SIMD_WIDTH <= width; x += ANOSMELLYA_SIMD_WIDTH) {
+        simd_store(
+            dy + x, simd_sub(simd_load(below + x), simd_load(above + x)));
+    }
+    for (; x < width; ++x) {
+        dy[x] = below[x] - above[x];
+    }
+}
+
+// Wrap a row index which may be a little outside the grid.
+static unsigned wrap_row(int y, unsigned height)
+{
+    int h = height;
+    return (y % h + h) % h;
+}
+
+// Convert count half precision values to floats.
+static void unpack_span(uint16_t const* src, float* dst, unsigned count)
+{
+    unsigned x = 0;
+    for (; x + ANOSMELLYA_SIMD_WIDTH <= count; x += ANOSMELLYA_SIMD_WIDTH) {
+        simd_store(dst + x, simd_load_half(src + x));
+    }
+    for (; x < count; ++x) {
+        dst[x] = half_to_float(src[x]);
+    }
+}
+
+// Store count floats in half precision, clamped to its range, and round the
+// floats in place to what was stored.
+static void pack_span(float* src, uint16_t* dst, unsigned count)
+{
+    unsigned x = 0;
+    SimdFloat v_max = simd_set(HALF_MAX);
+    SimdFloat v_min = simd_set(-HALF_MAX);
+    for (; x + ANOSMELLYA_SIMD_WIDTH <= count; x += ANOSMELLYA_SIMD_WIDTH) {
+        SimdFloat v = simd_max(simd_min(simd_load(src + x), v_max), v_min);
+        simd_store_half(dst + x, v);
+        simd_store(src + x, simd_load_half(dst + x));
+    }
+    for (; x < count; ++x) {
+        dst[x] = clamp_to_half(src[x]);
+        src[x] = half_to_float(dst[x]);
+    }
+}
+
+// Round the floats in place as pack_span does, for rows that aren't stored
+// but must match those that are.
+static void round_span(float* row, unsigned count)
+{
+    uint16_t halves[ANOSMELLYA_SIMD_WIDTH];
+    unsigned x = 0;
+    SimdFloat v_max = simd_set(HALF_MAX);
+    SimdFloat v_min = simd_set(-HALF_MAX);
+    for (; x + ANOSMELLYA_SIMD_WIDTH <= count; x += ANOSMELLYA_SIMD_WIDTH) {
+        simd_store_half(
+            halves, simd_max(simd_min(simd_load(row + x), v_max), v_min));
+        simd_store(row + x, simd_load_half(halves));
+    }
+    for (; x < count; ++x) {
+        row[x] = half_to_float(clamp_to_half(row[x]));
+    }
+}
+
+float const* Fluid::row(unsigned y, float* buffer)
+{
+    if (!half) {
+        return &grid.at(0, y);
+    }
+    unpack_span(&half_grid.at(0, y), buffer, width);
+    return buffer;
+}
+
+float const* Fluid::current_row(int y, float* buffer)
+{
+    unsigned wrapped = wrap_row(y, height);
+    if (!half) {
+        return &grid.at(0, wrapped);
+    }
+    unpack_span(&half_grid.at(0, wrapped) - 1, buffer, width + 2);
+    return buffer + 1;
+}
+
+float* Fluid::next_row(unsigned y, float* buffer)
+{
+    if (!half) {
+        return &next.at(0, y);
+    }
+    return buffer + (1 + y % 3) * (width + 2) + 1;
+}
+
+void Fluid::store_next_row(unsigned y, float* row)
+{
+    if (!half) {
+        next.refresh_row_ghosts(y);
+        return;
+    }
+    pack_span(row, &half_next.at(0, y), width);
+    half_next.refresh_row_ghosts(y);
+    row[-1] = row[width - 1];
+    row[width] = row[0];
+}
+
+void Fluid::tick_rows(unsigned start, unsigned end, float* scratch)
+{
+    if (threshold > 0.) {
+        tick_rows_tracked(start, end, scratch);
+        return;
+    }
+    // More than half would make the smell slosh back and forth forever:
+    float portion = fminf(dispersal, 0.5);
+    float keep = 1. - evap;
+    // A ring of the horizontally dispersed rows above, at, and below y:
+    float* ring[3] = { scratch, scratch + width, scratch + 2 * width };
+    // The gradient needs the next values of the rows just outside the band
+    // too. Those rows belong to other bands, so they only go in scratch space:
+    int first = gradient ? (int)start - 1 : (int)start;
+    int last = gradient ? (int)end : (int)end - 1;
+    float* halo_above = scratch + 3 * width;
+    float* halo_below = scratch + 4 * width;
+    float* buffer = scratch + scratch_size() - half_scratch_size();
+    // The next values of the last three rows, for the gradient:
+    float* done[3] = { NULL, NULL, NULL };
+    disperse_row(current_row(first - 1, buffer), ring[0], width, portion);
+    disperse_row(current_row(first, buffer), ring[1], width, portion);
+    for (int y = first; y <= last; ++y) {
+        disperse_row(current_row(y + 1, buffer), ring[2], width, portion);
+        bool in_band = y >= (int)start && y < (int)end;
+        float* dst = halo_below;
+        if (in_band) {
+            dst = next_row(y, buffer);
+        } else if (y < (int)start) {
+            dst = halo_above;
+        }
+        double row_total
+            = combine_rows(ring[0], ring[1], ring[2], dst, width, portion, keep);
+        if (in_band) {
+            store_next_row(y, dst);
+            row_totals[y] = row_total;
+        } else if (half) {
+            round_span(dst, width);
+        }
+        float* oldest = ring[0];
+        ring[0] = ring[1];
+        ring[1] = ring[2];
+        ring[2] = oldest;
+        if (gradient) {
+            done[0] = done[1];
+            done[1] = done[2];
+            done[2] = dst;
+            if (y >= first + 2) {
+                unsigned i = (y - 1) * width;
+                gradient_row(
+                    done[0], done[1], done[2], &grad_x[i], &grad_y[i], width);
+            }
+        }
+    }
+}
+
+// Get the largest magnitude of the values, or zero if there are none.
+static float max_magnitude(float const* values, unsigned count)
+{
+    unsigned i = 0;
+    SimdFloat v_max = simd_set(0.);
+    for (; i + ANOSMELLYA_SIMD_WIDTH <= count; i += ANOSMELLYA_SIMD_WIDTH) {
+        v_max = simd_max(v_max, simd_abs(simd_load(values + i)));
+    }
+    float max = simd_largest(v_max);
+    for (; i < count; ++i) {
+        float magnitude = fabsf(values[i]);
+        max = magnitude > max ? magnitude : max;
+    }
+    return max;
+}
+
+// Get the number of tiles in the block of a row starting at x.
+static unsigned block_width(unsigned width, unsigned x)
+{
+    return width - x < FLUID_BLOCK_COLS ? width - x : FLUID_BLOCK_COLS;
+}
+
+void Fluid::find_next_max(unsigned y, float const* row)
+{
+    for (unsigned b = 0; b < row_blocks; ++b) {
+        unsigned x = b * FLUID_BLOCK_COLS;
+        next_max[y * row_blocks + b]
+            = max_magnitude(row + x, block_width(width, x));
+    }
+}
+
+// Find the largest of the maxima of each block and its neighbors in a row,
+// which wraps around.
+static void find_near_max(float const* maxes, float* near, unsigned blocks)
+{
+    for (unsigned b = 0; b < blocks; ++b) {
+        float max = maxes[b];
+        max = fmaxf(max, maxes[b > 0 ? b - 1 : blocks - 1]);
+        max = fmaxf(max, maxes[b + 1 < blocks ? b + 1 : 0]);
+        near[b] = max;
+    }
+}
+
+// Whether block b is quiet in the given number of rows of near maxima.
+static bool is_quiet(
+    float* const* near, unsigned rows, unsigned b, float threshold)
+{
+    for (unsigned i = 0; i < rows; ++i) {
+        if (near[i][b] > threshold) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Fluid::tick_rows_tracked(unsigned start, unsigned end, float* scratch)
+{
+    float portion = fminf(dispersal, 0.5);
+    float keep = 1. - evap;
+    float* ring[3] = { scratch, scratch + width, scratch + 2 * width };
+    int first = gradient ? (int)start - 1 : (int)start;
+    int last = gradient ? (int)end : (int)end - 1;
+    float* halo_above = scratch + 3 * width;
+    float* halo_below = scratch + 4 * width;
+    float* buffer = scratch + scratch_size() - half_scratch_size();
+    float* done[3] = { NULL, NULL, NULL };
+    // For each of the five rows from the one above the one being made down,
+    // the largest amount in each block and its neighbors in the row. A block
+    // of the next tick is quiet if these are within the threshold for its row
+    // and the rows above and below it:
+    float* near[5];
+    for (unsigned i = 0; i < 5; ++i) {
+        near[i] = scratch + (gradient ? 5 : 3) * width + i * row_blocks;
+    }
+    auto next_near = [&](int y) {
+        float* oldest = near[0];
+        for (unsigned i = 0; i < 4; ++i) {
+            near[i] = near[i + 1];
+        }
+        near[4] = oldest;
+        find_near_max(&grid_max[wrap_row(y, height) * row_blocks], oldest,
+            row_blocks);
+    };
+    // Horizontally disperse the blocks of row y needed by the blocks around
+    // it that aren't quiet. The near rows must be those from y - 2 down. Only
+    // those blocks are unpacked from half precision:
+    auto disperse_needed = [&](int y, float* dst) {
+        if (width == 1) {
+            disperse_row(current_row(y, buffer), dst, width, portion);
+            return;
+        }
+        unsigned wrapped = wrap_row(y, height);
+        float const* src = half ? buffer + 1 : &grid.at(0, wrapped);
+        for (unsigned b = 0; b < row_blocks; ++b) {
+            if (!is_quiet(near, 5, b, threshold)) {
+                unsigned x = b * FLUID_BLOCK_COLS;
+                unsigned count = block_width(width, x);
+                if (half) {
+                    unpack_span(
+                        &half_grid.at(x, wrapped) - 1, buffer + x, count + 2);
+                }
+                disperse_span(src + x, dst + x, count, portion);
+            }
+        }
+    };
+    for (int y = first - 3; y <= first + 1; ++y) {
+        next_near(y);
+    }
+    disperse_needed(first - 1, ring[0]);
+    next_near(first + 2);
+    disperse_needed(first, ring[1]);
+    for (int y = first; y <= last; ++y) {
+        next_near(y + 3);
+        disperse_needed(y + 1, ring[2]);
+        bool in_band = y >= (int)start && y < (int)end;
+        float* dst = halo_below;
+        if (in_band) {
+            dst = next_row(y, buffer);
+        } else if (y < (int)start) {
+            dst = halo_above;
+        }
+        double row_total = 0.;
+        unsigned row_skipped = 0;
+        for (unsigned b = 0; b < row_blocks; ++b) {
+            unsigned x = b * FLUID_BLOCK_COLS;
+            unsigned count = block_width(width, x);
+            float* max = in_band ? &next_max[y * row_blocks + b] : NULL;
+            if (!is_quiet(near, 3, b, threshold)) {
+                row_total += combine_rows(ring[0] + x, ring[1] + x,
+                    ring[2] + x, dst + x, count, portion, keep);
+                if (max) {
+                    *max = max_magnitude(dst + x, count);
+                }
+                continue;
+            }
+            // A block already known to be zero is left alone, unless the row
+            // is only a buffer to be packed:
+            if (!max || *max != 0. || half) {
+                for (unsigned i = 0; i < count; ++i) {
+                    dst[x + i] = 0.;
+                }
+                if (max) {
+                    *max = 0.;
+                }
+            }
+            ++row_skipped;
+        }
+        if (in_band) {
+            store_next_row(y, dst);
+            row_totals[y] = row_total;
+            row_skips[y] = row_skipped;
+        } else if (half) {
+            round_span(dst, width);
+        }
+        float* oldest = ring[0];
+        ring[0] = ring[1];
+        ring[1] = ring[2];
+        ring[2] = oldest;
+        if (gradient) {
+            done[0] = done[1];
+            done[1] = done[2];
+            done[2] = dst;
+            if (y >= first + 2) {
+                unsigned i = (y - 1) * width;
+                gradient_row(
+                    done[0], done[1], done[2], &grad_x[i], &grad_y[i], width);
+            }
+        }
+    }
+}
+
+// Add up the values pairwise, which keeps the rounding error down to about the
+// logarithm of the count instead of the count.
+static double sum_pairwise(double const* values, unsigned count)
+{
+    if (count <= 8) {
+        double sum = 0.;
+        for (unsigned i = 0; i < count; ++i) {
+            sum += values[i];
+        }
+        return sum;
+    }
+    unsigned half = count / 2;
+    return sum_pairwise(values, half)
+        + sum_pairwise(values + half, count - half);
+}
+
+void Fluid::finish_tick()
+{
+    grid.swap(next);
+    half_grid.swap(half_next);
+    grid_max.swap(next_max);
+    total = sum_pairwise(row_totals.data(), row_totals.size());
+    skipped = 0;
+    for (unsigned y = 0; y < row_skips.size(); ++y) {
+        skipped += row_skips[y];
+    }
+}
+
+static float flow(float a, float b, float portion) { return (b - a) * portion; }
+
+static void disperse(Grid<float>& grid, float portion)
+{
+    // This flow is not completely symmetrical, but it's good enough.
+    for (unsigned y = 0; y < grid.get_height(); ++y) {
+        for (unsigned x = 0; x < grid.get_width(); ++x) {
+            float& here = grid.at(x, y);
+            float& right = grid.at_small_trans(x, y, 1, 0);
+            float& below = grid.at_small_trans(x, y, 0, 1);
+            float flow_right = flow(here, right, portion);
+            float flow_below = flow(here, below, portion);
+            here += flow_right;
+            right -= flow_right;
+            here += flow_below;
+            below -= flow_below;
+        }
+    }
+}
+
+// Evaporate the given portion of each tile of row y and return the row's new
+// total. Evaporation is done while totalling so the grid is only swept once.
+static double evaporate_row(Grid<float>& grid, unsigned y, float portion)
+{
+    float keep = 1. - portion;
+    float* row = &grid.at(0, y);
+    double row_total = 0.;
+    for (unsigned x = 0; x < grid.get_width(); ++x) {
+        row[x] *= keep;
+        row_total += row[x];
+    }
+    return row_total;
+}
+
+void Fluid::tick_reference()
+{
+    disperse(grid, dispersal);
+    for (unsigned y = 0; y < height; ++y) {
+        row_totals[y] = evaporate_row(grid, y, evap);
+    }
+    grid.refresh_ghosts();
+    total = sum_pairwise(row_totals.data(), row_totals.size());
+}
+
+void Fluid::find_gradient(unsigned start, unsigned end)
+{
+    for (unsigned y = start; y < end; ++y) {
+        unsigned i = y * width;
+        gradient_row(&grid.at(0, wrap_row((int)y - 1, height)), &grid.at(0, y),
+            &grid.at(0, wrap_row(y + 1, height)), &grad_x[i], &grad_y[i],
+            width);
+    }
+}
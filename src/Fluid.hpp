@@ -0,0 +1,209 @@
+#ifndef ANOSMELLYA_FLUID_H_
+#define ANOSMELLYA_FLUID_H_
+
+#include "Grid.hpp"
+#include "Half.hpp"
+#include "Vec2D.hpp"
+#include <stdint.h>
+#include <vector>
+
+namespace anosmellya {
+
+// The number of tiles across a block of a row whose activity is tracked:
+#define FLUID_BLOCK_COLS 64
+
+// A smell spread across the world that disperses and evaporates every tick.
+// The amounts are double-buffered; a tick reads the current grid and writes the
+// next one, then the two are swapped. Both grids have a ghost border kept up to
+// date, so neighbors are found without wrapping.
+//
+// A fluid can also keep its gradient, the differences between the neighbors of
+// each tile, computed as part of each tick so that animals and drawing don't
+// have to look at the neighbors themselves.
+//
+// Given a threshold, a fluid also tracks the largest amount in each block of
+// FLUID_BLOCK_COLS tiles of each row. A block is set to zero instead of being
+// ticked if it and the blocks around it are all within the threshold of zero,
+// which saves time where a smell is sparse at the cost of exactness.
+//
+// The amounts can also be stored in half precision, which halves the memory a
+// fluid takes and moves through each tick. Rows are unpacked to floats to be
+// worked on, so a tick rounds only once, when its results are stored. Amounts
+// beyond the range of half precision are clamped to it.
+class Fluid {
+    friend class Checkpoint;
+
+public:
+    // Make a fluid whose rows are cleared with clear_rows before use. Quiet
+    // blocks are only skipped if the threshold is positive. The amounts are
+    // stored in half precision if half is true.
+    Fluid(unsigned width, unsigned height, float dispersal, float evap,
+        bool gradient, float threshold, bool half);
+
+    // Set rows start to end - 1 to zero. The memory of each row is placed near
+    // the first thread to clear it, so rows should be cleared in the bands
+    // that will be ticked.
+    void clear_rows(unsigned start, unsigned end);
+
+    float at(unsigned x, unsigned y)
+    {
+        return half ? half_to_float(half_grid.at(x, y)) : grid.at(x, y);
+    }
+
+    // Get the amounts of row y, for reading only. If they are stored in half
+    // precision, they are unpacked into the buffer, which must hold the width.
+    float const* row(unsigned y, float* buffer);
+
+    // Add to the amount at the tile, keeping the ghosts in sync. This doesn't
+    // change the total, since tiles in different rows can be added to from
+    // different threads. Use add_to_total for that.
+    void add(unsigned x, unsigned y, float amount)
+    {
+        float tile;
+        if (half) {
+            uint16_t& stored = half_grid.at(x, y);
+            stored = clamp_to_half(half_to_float(stored) + amount);
+            half_grid.refresh_ghosts_at(x, y);
+            tile = half_to_float(stored);
+        } else {
+            float& stored = grid.at(x, y);
+            stored += amount;
+            grid.refresh_ghosts_at(x, y);
+            tile = stored;
+        }
+        if (threshold > 0.) {
+            float& max = grid_max[y * row_blocks + x / FLUID_BLOCK_COLS];
+            float magnitude = tile < 0. ? -tile : tile;
+            if (magnitude > max) {
+                max = magnitude;
+            }
+        }
+    }
+
+    // Get the total amount across all tiles. This is worked out by each tick,
+    // plus whatever has been passed to add_to_total since. The tick's part is
+    // the same no matter how the rows were split into bands.
+    double get_total() { return total; }
+
+    void add_to_total(double amount) { total += amount; }
+
+    unsigned get_width() { return width; }
+
+    unsigned get_height() { return height; }
+
+    bool has_gradient() { return gradient; }
+
+    bool is_half() { return half; }
+
+    // Get the gradient at the tile. The x is the right neighbor minus the left,
+    // and the y is the lower minus the upper. If the fluid keeps its gradient,
+    // this is as of the end of the last tick.
+    Vec2D gradient_at(unsigned x, unsigned y)
+    {
+        if (gradient) {
+            unsigned i = y * width + x;
+            return Vec2D(grad_x[i], grad_y[i]);
+        }
+        if (half) {
+            uint16_t* here = &half_grid.at(x, y);
+            int stride = half_grid.get_stride();
+            return Vec2D(half_to_float(here[1]) - half_to_float(here[-1]),
+                half_to_float(here[stride]) - half_to_float(here[-stride]));
+        }
+        float* here = &grid.at(x, y);
+        int stride = grid.get_stride();
+        return Vec2D(here[1] - here[-1], here[stride] - here[-stride]);
+    }
+
+    // Calculate the next dispersed and evaporated values of rows start to
+    // end - 1 in a single pass without making them current. The scratch space
+    // must hold scratch_size() floats. Bands of rows can be done in parallel.
+    // The gradient of the rows is calculated too if the fluid has one, which
+    // takes two more rows of dispersal per band, and so are the totals of the
+    // rows.
+    void tick_rows(unsigned start, unsigned end, float* scratch);
+
+    // Make the values calculated by tick_rows current and add up the total.
+    void finish_tick();
+
+    // Disperse and evaporate for one tick using the original in-place kernel.
+    // The results differ a little from those of tick_rows, since the original
+    // kernel moves smell through the grid sequentially. This sets the total.
+    // It can't be used on a fluid stored in half precision.
+    void tick_reference();
+
+    // Calculate the gradient of rows start to end - 1 from the current values.
+    // This is only needed after tick_reference.
+    void find_gradient(unsigned start, unsigned end);
+
+    unsigned scratch_size()
+    {
+        return (gradient ? 5 : 3) * width
+            + (threshold > 0. ? 5 * row_blocks : 0) + half_scratch_size();
+    }
+
+    // Get the number of blocks skipped as quiet in the last tick.
+    unsigned get_skipped() { return skipped; }
+
+    // Get the number of blocks across all rows.
+    unsigned get_block_count() { return height * row_blocks; }
+
+private:
+    // Do what tick_rows does, skipping quiet blocks.
+    void tick_rows_tracked(unsigned start, unsigned end, float* scratch);
+
+    // Find the largest amount in each block of row y of next, given as the
+    // row.
+    void find_next_max(unsigned y, float const* row);
+
+    // The scratch space needed for a row to unpack into and the three rows
+    // taken in turn by next_row, each with ghost tiles.
+    unsigned half_scratch_size() { return half ? 4 * (width + 2) : 0; }
+
+    // Get row y of the current amounts with ghost tiles, wrapping y around. If
+    // they are stored in half precision, they are unpacked into the buffer,
+    // which must hold the width plus two.
+    float const* current_row(int y, float* buffer);
+
+    // Get where to write row y of next. If it is stored in half precision,
+    // that is one of the three rows of the buffer after the first, taken in
+    // turn.
+    float* next_row(unsigned y, float* buffer);
+
+    // Finish writing row y of next to where next_row said, refreshing its
+    // ghosts. If it is stored in half precision, the row is packed and then
+    // rounded in place, with ghosts, to match what is stored.
+    void store_next_row(unsigned y, float* row);
+
+    unsigned width;
+    unsigned height;
+    // Only the grids of the precision used have any tiles:
+    Grid<float> grid;
+    Grid<float> next;
+    Grid<uint16_t> half_grid;
+    Grid<uint16_t> half_next;
+    bool half;
+    float dispersal;
+    float evap;
+    bool gradient;
+    double total;
+    // The total of each row as of the last tick, added up in order:
+    std::vector<double> row_totals;
+    // Empty if there is no gradient:
+    std::vector<float> grad_x;
+    std::vector<float> grad_y;
+    float threshold;
+    // The number of blocks in each row:
+    unsigned row_blocks;
+    // The largest magnitude in each block of grid and next, or more. A block
+    // of next with a maximum of zero is known to be all zero:
+    std::vector<float> grid_max;
+    std::vector<float> next_max;
+    // The number of blocks of each row skipped in the last tick:
+    std::vector<unsigned> row_skips;
+    unsigned skipped;
+};
+
+} /* namespace anosmellya */
+
+#endif /* ANOSMELLYA_FLUID_H_ */
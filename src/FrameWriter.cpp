@@ -0,0 +1,158 @@
+#include "FrameWriter.hpp"
+
+using namespace anosmellya;
+
+// NOTE: As in ThreadPool.cpp, fallible SDL calls are retried in empty loops.
+
+// The frame rate written to Y4M headers. Encoders can be told otherwise.
+#define Y4M_FRAME_RATE 30
+
+FrameWriter::FrameWriter(FILE* to, FrameFormat format, unsigned scale)
+    : to(to)
+    , format(format)
+    , scale(scale)
+    , frame_width(0)
+    , frame_height(0)
+    , rgb()
+    , planes()
+    , head(0)
+    , tail(0)
+    , free_slots(SDL_CreateSemaphore(RING_SIZE))
+    , filled_slots(SDL_CreateSemaphore(0))
+    , thread(NULL)
+{
+    for (unsigned i = 0; i < RING_SIZE; ++i) {
+        ring[i].quit = false;
+    }
+    if (free_slots && filled_slots) {
+        thread = SDL_CreateThread(thread_proc, "frames", this);
+    }
+}
+
+FrameWriter::~FrameWriter()
+{
+    if (thread) {
+        while (SDL_SemWait(free_slots)) { }
+        ring[head].quit = true;
+        while (SDL_SemPost(filled_slots)) { }
+        SDL_WaitThread(thread, NULL);
+    }
+    fflush(to);
+    if (free_slots) {
+        SDL_DestroySemaphore(free_slots);
+    }
+    if (filled_slots) {
+        SDL_DestroySemaphore(filled_slots);
+    }
+}
+
+Snapshot& FrameWriter::begin_frame()
+{
+    if (thread) {
+        while (SDL_SemWait(free_slots)) { }
+    }
+    return ring[head].snap;
+}
+
+void FrameWriter::end_frame()
+{
+    if (!thread) {
+        write(ring[head].snap);
+        return;
+    }
+    head = (head + 1) % RING_SIZE;
+    while (SDL_SemPost(filled_slots)) { }
+}
+
+void FrameWriter::render(Snapshot const& snap)
+{
+    // Smells first, a square per tile:
+    for (unsigned y = 0; y < frame_height; ++y) {
+        uint8_t* dst = &rgb[(size_t)y * frame_width * 3];
+        uint32_t const* src
+            = &snap.smell_pixels[(size_t)(y / scale) * snap.width];
+        for (unsigned x = 0; x < frame_width; ++x) {
+            uint32_t pixel = src[x / scale];
+            dst[x * 3] = pixel >> 16 & 0xFF;
+            dst[x * 3 + 1] = pixel >> 8 & 0xFF;
+            dst[x * 3 + 2] = pixel & 0xFF;
+        }
+    }
+    // Then animals over them, clipped to the frame:
+    int width = frame_width;
+    int height = frame_height;
+    for (unsigned look = 0; look < LOOK_COUNT; ++look) {
+        std::vector<Vec2D> const& animals = snap.animals[look];
+        uint8_t const* color = look_colors[look];
+        for (unsigned i = 0; i < animals.size(); ++i) {
+            int left = (animals[i].x - 0.5) * scale;
+            int top = (animals[i].y - 0.5) * scale;
+            int right = left + scale;
+            int bottom = top + scale;
+            left = left > 0 ? left : 0;
+            top = top > 0 ? top : 0;
+            right = right < width ? right : width;
+            bottom = bottom < height ? bottom : height;
+            for (int y = top; y < bottom; ++y) {
+                uint8_t* dst = &rgb[((size_t)y * width + left) * 3];
+                for (int x = left; x < right; ++x) {
+                    *dst++ = color[0];
+                    *dst++ = color[1];
+                    *dst++ = color[2];
+                }
+            }
+        }
+    }
+}
+
+void FrameWriter::write(Snapshot const& snap)
+{
+    if (frame_width == 0) {
+        frame_width = snap.width * scale;
+        frame_height = snap.height * scale;
+        size_t size = (size_t)frame_width * frame_height * 3;
+        rgb.resize(size);
+        if (format == FRAME_Y4M) {
+            planes.resize(size);
+            fprintf(to, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C444\n", frame_width,
+                frame_height, Y4M_FRAME_RATE);
+        }
+    }
+    render(snap);
+    size_t area = (size_t)frame_width * frame_height;
+    if (format == FRAME_PPM) {
+        fprintf(to, "P6\n%u %u\n255\n", frame_width, frame_height);
+        fwrite(rgb.data(), 1, area * 3, to);
+        return;
+    }
+    // Convert to limited range BT.601, which is what players expect by
+    // default:
+    uint8_t* ys = planes.data();
+    uint8_t* us = ys + area;
+    uint8_t* vs = us + area;
+    for (size_t i = 0; i < area; ++i) {
+        int r = rgb[i * 3];
+        int g = rgb[i * 3 + 1];
+        int b = rgb[i * 3 + 2];
+        ys[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+        us[i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+        vs[i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+    }
+    fputs("FRAME\n", to);
+    fwrite(planes.data(), 1, area * 3, to);
+}
+
+int FrameWriter::thread_proc(void* arg)
+{
+    FrameWriter* writer = (FrameWriter*)arg;
+    for (;;) {
+        while (SDL_SemWait(writer->filled_slots)) { }
+        Entry const& entry = writer->ring[writer->tail];
+        if (entry.quit) {
+            return 0;
+        }
+        writer->write(entry.snap);
+        writer->tail = (writer->tail + 1) % RING_SIZE;
+        while (SDL_SemPost(writer->free_slots)) { }
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef ANOSMELLYA_FRAME_WRITER_H_
+#define ANOSMELLYA_FRAME_WRITER_H_
+
+#include "Snapshot.hpp"
+#include <SDL2/SDL.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+namespace anosmellya {
+
+// Y4M is YUV4MPEG2 with 4:4:4 chroma, which video encoders read directly. PPM
+// is a stream of binary (P6) images, one per frame.
+enum FrameFormat { FRAME_Y4M, FRAME_PPM };
+
+// Writes snapshots of the world to a file as video frames, without SDL video,
+// on a thread of its own. Each tile is a square of scale pixels, with smells
+// and animals colored as in the window. Snapshots are passed through a small
+// ring in the same way as statistics are passed through StatsWriter's, and
+// each slot's snapshot is reused from frame to frame. If the ring is full,
+// begin_frame waits for the writer thread to catch up. If the thread can't be
+// created, frames are written directly instead.
+class FrameWriter {
+public:
+    FrameWriter(FILE* to, FrameFormat format, unsigned scale);
+
+    // Finish writing everything that was queued.
+    ~FrameWriter();
+
+    // Get a snapshot to fill in with the next frame.
+    Snapshot& begin_frame();
+
+    // Queue the snapshot from begin_frame to be written.
+    void end_frame();
+
+private:
+    static const unsigned RING_SIZE = 4;
+
+    struct Entry {
+        Snapshot snap;
+        bool quit;
+    };
+
+    FrameWriter(FrameWriter const& copy);
+    FrameWriter& operator=(FrameWriter const& copy);
+
+    static int thread_proc(void* arg);
+
+    // Draw the snapshot into rgb, scaled up.
+    void render(Snapshot const& snap);
+
+    void write(Snapshot const& snap);
+
+    FILE* to;
+    FrameFormat format;
+    unsigned scale;
+    // The size of the frames, fixed by the first one:
+    unsigned frame_width;
+    unsigned frame_height;
+    // The frame being written, as RGB triples and then, for Y4M, as planes:
+    std::vector<uint8_t> rgb;
+    std::vector<uint8_t> planes;
+    Entry ring[RING_SIZE];
+    // The next slot to fill, only touched by the simulation thread:
+    unsigned head;
+    // The next slot to read, only touched by the writer thread:
+    unsigned tail;
+    SDL_sem* free_slots;
+    SDL_sem* filled_slots;
+    // NULL if frames are written directly:
+    SDL_Thread* thread;
+};
+
+} /* namespace anosmellya */
+
+#endif /* ANOSMELLYA_FRAME_WRITER_H_ */
@@ -0,0 +1,43 @@
+#include "GenomePool.hpp"
+
+using namespace anosmellya;
+
+GenomePool::GenomePool(unsigned capacity)
+    : blocks((capacity + BLOCK_SIZE - 1) / BLOCK_SIZE, NULL)
+    , free_list()
+    , used(0)
+    , lock(0)
+{
+}
+
+GenomePool::~GenomePool()
+{
+    for (unsigned i = 0; i < blocks.size(); ++i) {
+        delete[] blocks[i];
+    }
+}
+
+unsigned GenomePool::add(Genome const& genome)
+{
+    unsigned i;
+    SDL_AtomicLock(&lock);
+    if (!free_list.empty()) {
+        i = free_list.back();
+        free_list.pop_back();
+    } else {
+        i = used++;
+        if (i % BLOCK_SIZE == 0) {
+            blocks[i / BLOCK_SIZE] = new Genome[BLOCK_SIZE];
+        }
+    }
+    SDL_AtomicUnlock(&lock);
+    at(i) = genome;
+    return i;
+}
+
+void GenomePool::remove(unsigned i)
+{
+    SDL_AtomicLock(&lock);
+    free_list.push_back(i);
+    SDL_AtomicUnlock(&lock);
+}
@@ -0,0 +1,49 @@
+#ifndef ANOSMELLYA_GENOME_POOL_H_
+#define ANOSMELLYA_GENOME_POOL_H_
+
+#include "Animal.hpp"
+#include <SDL2/SDL.h>
+#include <vector>
+
+namespace anosmellya {
+
+// Storage for the genomes of living animals, referenced by index. Genomes are
+// allocated in blocks as the population grows and never move, so an index stays
+// valid until it is removed. Genomes can be added and removed from several
+// threads at once. The pool can't be copied.
+class GenomePool {
+    friend class Checkpoint;
+
+public:
+    // Create a pool for up to capacity genomes at once.
+    GenomePool(unsigned capacity);
+
+    ~GenomePool();
+
+    Genome& at(unsigned i) { return blocks[i / BLOCK_SIZE][i % BLOCK_SIZE]; }
+
+    // Store a copy of the genome and return its index.
+    unsigned add(Genome const& genome);
+
+    // Free the index for reuse.
+    void remove(unsigned i);
+
+private:
+    static const unsigned BLOCK_SIZE = 1024;
+
+    GenomePool(GenomePool const& copy);
+    GenomePool& operator=(GenomePool const& copy);
+
+    // Enough entries for the capacity are made up front so that the vector
+    // doesn't reallocate while other threads read it:
+    std::vector<Genome*> blocks;
+    std::vector<unsigned> free_list;
+    // The number of indices ever handed out:
+    unsigned used;
+    // Guards free_list, used, and block allocation:
+    SDL_SpinLock lock;
+};
+
+} /* namespace anosmellya */
+
+#endif /* ANOSMELLYA_GENOME_POOL_H_ */
@@ -1,48 +1,104 @@
 #ifndef ANOSMELLYA_GRID_H_
 #define ANOSMELLYA_GRID_H_
 
+#include "GridAllocator.hpp"
 #include <new>
 #include <stdlib.h>
+#include <string.h>
 
 namespace anosmellya {
 
+// A wrapping grid of tiles. A grid can be padded with ghost tiles around the
+// edges which copy the tiles on the opposite edges, so that the neighbors of
+// any tile can be found with plain pointer offsets. The padding is at most the
+// width and height, and the ghosts must be refreshed after edge tiles change.
+// Memory comes from a GridAllocator, and rows are aligned to cache lines where
+// the tile size allows.
 template <typename T> class Grid {
 public:
     Grid()
         : width(0)
         , height(0)
+        , pad(0)
+        , lead(0)
+        , stride(0)
+        , allocator(&GridAllocator::get_default())
         , tiles(NULL)
+        , origin(NULL)
     {
     }
 
+    // Make a grid of zero bytes.
     Grid(unsigned width, unsigned height)
-        : width(width)
-        , height(height)
-        , tiles((T*)calloc(width * sizeof(T), height))
+        : Grid(width, height, 0, &GridAllocator::get_default())
     {
-        check_oom();
+        memset((void*)tiles, 0, tile_count() * sizeof(T));
     }
 
     Grid(unsigned width, unsigned height, T fill)
+        : Grid(width, height, fill, 0)
+    {
+    }
+
+    Grid(unsigned width, unsigned height, T fill, unsigned pad)
+        : Grid(width, height, pad, &GridAllocator::get_default())
+    {
+        fill_rows(0, height, fill);
+    }
+
+    // Make a grid from the allocator, or the default one if it is NULL, and
+    // leave its tiles unset. Every row must be filled with fill_rows before
+    // use. Rows can be filled by the threads that will work on them, so that
+    // their memory is placed near those threads.
+    Grid(unsigned width, unsigned height, unsigned pad,
+        GridAllocator* allocator)
         : width(width)
         , height(height)
-        , tiles((T*)malloc(width * height * sizeof(T)))
+        , pad(pad)
+        , lead(lead_for(pad))
+        , stride(stride_for(width, pad))
+        , allocator(allocator ? allocator : &GridAllocator::get_default())
+        , tiles((T*)this->allocator->allocate(tile_count() * sizeof(T)))
+        , origin(tiles + pad * stride + lead)
     {
         check_oom();
-        for (unsigned i = 0; i < width * height; ++i) {
-            tiles[i] = fill;
-        }
     }
 
     ~Grid()
     {
-        for (unsigned i = 0; i < width * height; ++i) {
+        for (unsigned i = 0; i < tile_count(); ++i) {
             tiles[i].~T();
         }
-        free(tiles);
+        if (tiles) {
+            allocator->release(tiles, tile_count() * sizeof(T));
+        }
     }
 
-    T& at(unsigned x, unsigned y) { return tiles[y * width + x]; }
+    // The number of tiles from the start of one row to the next in a grid of
+    // the width and padding. Rows start on GRID_ALIGN bytes where tiles fit
+    // evenly into that.
+    static int stride_for(unsigned width, unsigned pad)
+    {
+        if (GRID_ALIGN % sizeof(T) != 0) {
+            return width + 2 * pad;
+        }
+        unsigned line = GRID_ALIGN / sizeof(T);
+        return (lead_for(pad) + width + pad + line - 1) / line * line;
+    }
+
+    // Set rows start to end - 1 to the value, along with their ghosts. The
+    // ghost rows above and below the grid are set with the first and last rows.
+    void fill_rows(unsigned start, unsigned end, T with)
+    {
+        T* from = start == 0 ? tiles : origin + (int)start * stride - lead;
+        T* to = end == height ? tiles + tile_count()
+                              : origin + (int)end * stride - lead;
+        for (; from < to; ++from) {
+            *from = with;
+        }
+    }
+
+    T& at(unsigned x, unsigned y) { return origin[y * stride + x]; }
 
     // Offset x and y by ox and oy units, respectively, wrapping if needed.
     void trans(unsigned& x, unsigned& y, int ox, int oy)
@@ -100,21 +156,118 @@ public:
         return at(x, y);
     }
 
-    void fill(T with)
+    void fill(T with) { fill_rows(0, height, with); }
+
+    // Copy the tiles of row y into its ghosts, including whole ghost rows.
+    void refresh_row_ghosts(unsigned y)
+    {
+        T* row = &at(0, y);
+        for (int i = 1; i <= (int)pad; ++i) {
+            row[-i] = row[width - i];
+            row[width - 1 + i] = row[i - 1];
+        }
+        if (y < pad) {
+            copy_row(row, row + (int)height * stride);
+        }
+        if (y >= height - pad) {
+            copy_row(row, row - (int)height * stride);
+        }
+    }
+
+    void refresh_ghosts()
     {
-        for (unsigned i = 0; i < width * height; ++i) {
-            tiles[i] = with;
+        for (unsigned y = 0; y < height; ++y) {
+            refresh_row_ghosts(y);
         }
     }
 
+    // Copy the tile at (x, y) into its ghosts, if it has any.
+    void refresh_ghosts_at(unsigned x, unsigned y)
+    {
+        if (x >= pad && x < width - pad && y >= pad && y < height - pad) {
+            return;
+        }
+        T& tile = at(x, y);
+        // The offsets of the tile's images. Small grids can have two images
+        // on each axis besides the tile itself.
+        int oxs[3] = { 0, 0, 0 };
+        int oys[3] = { 0, 0, 0 };
+        unsigned nx = 1;
+        unsigned ny = 1;
+        if (x < pad) {
+            oxs[nx++] = width;
+        }
+        if (x >= width - pad) {
+            oxs[nx++] = -(int)width;
+        }
+        if (y < pad) {
+            oys[ny++] = height * stride;
+        }
+        if (y >= height - pad) {
+            oys[ny++] = -(int)height * stride;
+        }
+        for (unsigned i = 0; i < nx; ++i) {
+            for (unsigned j = 0; j < ny; ++j) {
+                (&tile)[oxs[i] + oys[j]] = tile;
+            }
+        }
+    }
+
+    // Exchange contents with another grid of the same dimensions and padding.
+    void swap(Grid& other)
+    {
+        GridAllocator* tmp_allocator = allocator;
+        allocator = other.allocator;
+        other.allocator = tmp_allocator;
+        T* tmp = tiles;
+        tiles = other.tiles;
+        other.tiles = tmp;
+        tmp = origin;
+        origin = other.origin;
+        other.origin = tmp;
+    }
+
     unsigned get_width() { return width; }
 
     unsigned get_height() { return height; }
 
+    // The distance between the starts of rows, in tiles.
+    int get_stride() { return stride; }
+
+    // Get all tile_count() tiles, ghosts and alignment space included, row by
+    // row. This is for saving and loading grids as a whole.
+    T* get_tiles() { return tiles; }
+
+    unsigned tile_count() { return stride * (height + 2 * pad); }
+
 private:
     unsigned width;
     unsigned height;
+    unsigned pad;
+    // The number of tiles before x = 0 in each row, at least pad:
+    unsigned lead;
+    int stride;
+    GridAllocator* allocator;
     T* tiles;
+    // Where tile (0, 0) is, after the padding:
+    T* origin;
+
+    static unsigned lead_for(unsigned pad)
+    {
+        if (pad == 0 || GRID_ALIGN % sizeof(T) != 0) {
+            return pad;
+        }
+        unsigned line = GRID_ALIGN / sizeof(T);
+        return (pad + line - 1) / line * line;
+    }
+
+    // Copy a row and its ghost columns.
+    void copy_row(T const* from, T* to)
+    {
+        for (int x = -(int)pad; x < (int)(width + pad); ++x) {
+            to[x] = from[x];
+        }
+    }
 
     void check_oom()
     {
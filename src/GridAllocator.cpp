@@ -0,0 +1,92 @@
+#include "GridAllocator.hpp"
+#include <stdlib.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+using namespace anosmellya;
+
+// The size of huge pages assumed when rounding mapping sizes:
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+static AlignedAllocator aligned_allocator;
+
+static GridAllocator* default_allocator = &aligned_allocator;
+
+GridAllocator& GridAllocator::get_default() { return *default_allocator; }
+
+void GridAllocator::set_default(GridAllocator& allocator)
+{
+    default_allocator = &allocator;
+}
+
+void* AlignedAllocator::allocate(size_t size)
+{
+#ifdef _WIN32
+    return _aligned_malloc(size > 0 ? size : 1, GRID_ALIGN);
+#else
+    void* ptr;
+    // Big blocks are mapped fresh by malloc, so they aren't touched here:
+    if (posix_memalign(&ptr, GRID_ALIGN, size > 0 ? size : 1)) {
+        return NULL;
+    }
+    return ptr;
+#endif
+}
+
+void AlignedAllocator::release(void* ptr, size_t)
+{
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+// Round the size up to a whole number of huge pages.
+static size_t round_to_huge_pages(size_t size)
+{
+    return (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+}
+
+void* HugePageAllocator::allocate(size_t size)
+{
+#ifdef __linux__
+    if (size >= HUGE_PAGE_SIZE) {
+        size_t mapped = round_to_huge_pages(size);
+        void* ptr = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        ptr = mmap(NULL, mapped, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+        if (ptr == MAP_FAILED) {
+            // There may be no huge pages reserved, so fall back on normal
+            // pages and hope they can be made transparently huge:
+            ptr = mmap(NULL, mapped, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (ptr == MAP_FAILED) {
+                return NULL;
+            }
+#ifdef MADV_HUGEPAGE
+            madvise(ptr, mapped, MADV_HUGEPAGE);
+#endif
+        }
+        return ptr;
+    }
+#endif
+    return small.allocate(size);
+}
+
+void HugePageAllocator::release(void* ptr, size_t size)
+{
+#ifdef __linux__
+    if (size >= HUGE_PAGE_SIZE) {
+        munmap(ptr, round_to_huge_pages(size));
+        return;
+    }
+#endif
+    small.release(ptr, size);
+}
@@ -0,0 +1,56 @@
+#ifndef ANOSMELLYA_GRID_ALLOCATOR_H_
+#define ANOSMELLYA_GRID_ALLOCATOR_H_
+
+#include <stddef.h>
+
+namespace anosmellya {
+
+// The alignment of all memory given out for grids, a cache line:
+#define GRID_ALIGN 64
+
+// Where the memory of grids comes from. Memory is given out untouched where
+// possible, so that each page ends up on the NUMA node of the thread that first
+// writes to it. Grids use the default allocator unless given another.
+class GridAllocator {
+public:
+    virtual ~GridAllocator() { }
+
+    // Get size bytes aligned to GRID_ALIGN, or NULL if there isn't enough
+    // memory. The contents are undefined.
+    virtual void* allocate(size_t size) = 0;
+
+    // Give back memory from allocate, given the same size.
+    virtual void release(void* ptr, size_t size) = 0;
+
+    static GridAllocator& get_default();
+
+    // Make grids made from now on use the allocator, which must outlive them.
+    static void set_default(GridAllocator& allocator);
+};
+
+// Allocates from the heap with GRID_ALIGN alignment.
+class AlignedAllocator : public GridAllocator {
+public:
+    void* allocate(size_t size);
+
+    void release(void* ptr, size_t size);
+};
+
+// Allocates big blocks from huge pages where the system allows, to save TLB
+// misses when sweeping across large grids. Explicit huge pages (MAP_HUGETLB)
+// are tried first, then transparent huge pages are asked for with madvise.
+// Small blocks, and all blocks on systems without huge pages, come from an
+// AlignedAllocator.
+class HugePageAllocator : public GridAllocator {
+public:
+    void* allocate(size_t size);
+
+    void release(void* ptr, size_t size);
+
+private:
+    AlignedAllocator small;
+};
+
+} /* namespace anosmellya */
+
+#endif /* ANOSMELLYA_GRID_ALLOCATOR_H_ */
@@ -0,0 +1,78 @@
+#ifndef ANOSMELLYA_HALF_H_
+#define ANOSMELLYA_HALF_H_
+
+#include <stdint.h>
+#include <string.h>
+
+namespace anosmellya {
+
+// Conversions between floats and IEEE half precision floats stored in 16 bits,
+// rounding to the nearest as the F16C instructions do. These are used one
+// value at a time and where F16C isn't available.
+
+// The largest finite half precision value:
+#define HALF_MAX 65504.f
+
+static inline uint32_t float_bits(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+static inline float bits_float(uint32_t bits)
+{
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+static inline uint16_t float_to_half(float f)
+{
+    uint32_t bits = float_bits(f);
+    uint32_t sign = bits & 0x80000000u;
+    bits ^= sign;
+    uint32_t half;
+    if (bits >= 0x47800000u) {
+        // Too large to represent, infinite, or not a number:
+        half = bits > 0x7f800000u ? 0x7e00 : 0x7c00;
+    } else if (bits < 0x38800000u) {
+        // Subnormal or zero. Adding this lines the mantissa up with the last
+        // place of a half, so the float addition does the rounding:
+        uint32_t magic = 126u << 23;
+        half = float_bits(bits_float(bits) + bits_float(magic)) - magic;
+    } else {
+        uint32_t odd = (bits >> 13) & 1;
+        bits += ((uint32_t)(15 - 127) << 23) + 0xfff + odd;
+        half = bits >> 13;
+    }
+    return half | sign >> 16;
+}
+
+// Convert to half precision, clamping to the largest finite values instead of
+// going infinite.
+static inline uint16_t clamp_to_half(float f)
+{
+    f = f > HALF_MAX ? HALF_MAX : f;
+    return float_to_half(f < -HALF_MAX ? -HALF_MAX : f);
+}
+
+static inline float half_to_float(uint16_t half)
+{
+    uint32_t bits = (uint32_t)(half & 0x7fff) << 13;
+    uint32_t exp = bits & (0x7c00u << 13);
+    bits += (uint32_t)(127 - 15) << 23;
+    if (exp == 0x7c00u << 13) {
+        // Infinite or not a number:
+        bits += (uint32_t)(128 - 16) << 23;
+    } else if (exp == 0) {
+        // Subnormal or zero, normalized by the float unit:
+        bits += 1u << 23;
+        bits = float_bits(bits_float(bits) - bits_float(113u << 23));
+    }
+    return bits_float(bits | (uint32_t)(half & 0x8000) << 16);
+}
+
+} /* namespace anosmellya */
+
+#endif /* ANOSMELLYA_HALF_H_ */
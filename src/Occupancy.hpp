@@ -0,0 +1,82 @@
+#ifndef ANOSMELLYA_OCCUPANCY_H_
+#define ANOSMELLYA_OCCUPANCY_H_
+
+#include <stdint.h>
+#include <vector>
+
+namespace anosmellya {
+
+// One bit per tile telling whether something is there, so that sparse grids
+// can be scanned a word of tiles at a time. Each row starts on a new word, so
+// different rows can be changed from different threads.
+class Occupancy {
+public:
+    Occupancy(unsigned width, unsigned height)
+        : width(width)
+        , row_words((width + 63) / 64)
+        , bits(row_words * height, 0)
+    {
+    }
+
+    bool get(unsigned x, unsigned y)
+    {
+        return (word(x, y) >> (x % 64)) & 1;
+    }
+
+    void set(unsigned x, unsigned y) { word(x, y) |= (uint64_t)1 << (x % 64); }
+
+    void clear(unsigned x, unsigned y)
+    {
+        word(x, y) &= ~((uint64_t)1 << (x % 64));
+    }
+
+    // Get the bits, row by row, for saving and loading them as a whole.
+    std::vector<uint64_t>& get_bits() { return bits; }
+
+    // Find the first occupied tile in row y at or after x. The width is
+    // returned if there is none.
+    unsigned next(unsigned x, unsigned y)
+    {
+        if (x >= width) {
+            return width;
+        }
+        uint64_t const* row = &bits[y * row_words];
+        unsigned i = x / 64;
+        uint64_t w = row[i] & (~(uint64_t)0 << (x % 64));
+        while (w == 0) {
+            if (++i >= row_words) {
+                return width;
+            }
+            w = row[i];
+        }
+        return i * 64 + count_trailing_zeros(w);
+    }
+
+private:
+    unsigned width;
+    unsigned row_words;
+    std::vector<uint64_t> bits;
+
+    uint64_t& word(unsigned x, unsigned y)
+    {
+        return bits[y * row_words + x / 64];
+    }
+
+    // w must not be zero.
+    static unsigned count_trailing_zeros(uint64_t w)
+    {
+#ifdef __GNUC__
+        return __builtin_ctzll(w);
+#else
+        unsigned n = 0;
+        for (; !(w & 1); w >>= 1) {
+            ++n;
+        }
+        return n;
+#endif
+    }
+};
+
+} /* namespace anosmellya */
+
+#endif /* ANOSMELLYA_OCCUPANCY_H_ */
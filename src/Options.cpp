@@ -1,5 +1,7 @@
 #include "Options.hpp"
+#include "BinaryStats.hpp"
 #include "Random.hpp"
+#include "simd.hpp"
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -63,10 +65,58 @@ Options:\n\
                          on. The default is 10.\n\
  -flush-interval <int>   Flush printed statistics every <int> ticks. The\n\
                          default is to flush whenever the stdio buffer fills.\n\
+ -stat-format <format>   Print statistics in <format>, which is json (the\n\
+                         default), binary, or delta. The binary formats are\n\
+                         described in src/BinaryStats.hpp; delta is smaller.\n\
+ -stat-file <path>       Write statistics to the file at <path> instead of\n\
+                         standard output.\n\
+ -stats-to-json <path>   Print the binary statistics in the file at <path> as\n\
+                         JSON lines, then exit.\n\
  -frame-delay <delay>    Delay for <delay> milliseconds per frame.\n\
  -pixel-size <size>      Set the simulation pixel size in screen pixels.\n\
  -max-threads <threads>  The maximum number of threads used for computation.\n\
                          The default is the number of computer cores.\n\
+ -reference-fluids       Use the original, slower smell dispersal code. This\n\
+                         is for comparison with the default.\n\
+ -gradient-fields        Work out smell gradients for all tiles along with\n\
+                         the smells instead of for each animal. Animals then\n\
+                         don't notice smells left earlier in the same tick.\n\
+ -half-fluids            Store smells in half precision, which takes half the\n\
+                         memory. It is only faster in builds with F16C\n\
+                         instructions, and much slower otherwise. The smells\n\
+                         are rounded each tick, so results diverge from\n\
+                         those in single precision. This is ignored with\n\
+                         -reference-fluids.\n\
+ -print-thread-usage     Print how busy each thread was as JSON to standard\n\
+                         error when quitting.\n\
+ -ticks <ticks>          Quit after simulating <ticks> ticks. The default is\n\
+                         to run until told to quit. With -no-draw and\n\
+                         -no-wait, the ticks are run as fast as possible\n\
+                         without checking for input, and the time taken is\n\
+                         printed as JSON to standard error at the end.\n\
+ -wait                   Wait between frames. This is the default.\n\
+ -no-wait                Run as fast as possible, as if W had been pressed.\n\
+ -render-thread          Simulate on a separate thread from drawing and\n\
+                         input, so that drawing doesn't slow the simulation.\n\
+                         The latest tick is drawn each frame; ticks in\n\
+                         between may not be drawn.\n\
+ -frames-out <path>      Write the world as video frames to the file at\n\
+                         <path>, or to standard output if <path> is -. This\n\
+                         needs no window. Tiles are -pixel-size pixels wide.\n\
+                         Standard output can only be used if statistics go\n\
+                         elsewhere, or can't be printed at all.\n\
+ -frame-interval <int>   Write a frame every <int> ticks. The default is 1.\n\
+ -frame-format <format>  Write frames in <format>, which is y4m (the default)\n\
+                         or ppm, a stream of binary PPM images.\n\
+ -checkpoint <path>      Save the whole state of the world to the file at\n\
+                         <path> when quitting, replacing the file safely.\n\
+ -checkpoint-every <int> Also save the checkpoint every <int> ticks.\n\
+ -restore <path>         Carry on from the checkpoint at <path>. The world\n\
+                         size, seed, configuration, and fluid options are\n\
+                         those of the checkpoint. -ticks still counts from\n\
+                         the start of the original run.\n\
+ -huge-pages             Put large grids in huge pages where the system\n\
+                         allows, which can speed up big worlds.\n\
  -help                   Print this help information.\n\
  -version                Print version information.");
 }
@@ -85,9 +135,25 @@ Options::Options(int argc, char* argv[])
     , print_stats(false)
     , stat_interval(10)
     , flush_interval(0)
+    , stat_format(STAT_JSON)
+    , stat_file(NULL)
     , frame_delay(60)
     , pixel_size(3)
     , max_threads(0)
+    , reference_fluids(false)
+    , gradient_fields(false)
+    , half_fluids(false)
+    , print_thread_usage(false)
+    , ticks(0)
+    , wait(true)
+    , render_thread(false)
+    , frames_out(NULL)
+    , frame_interval(1)
+    , frame_format(FRAME_Y4M)
+    , checkpoint(NULL)
+    , checkpoint_every(0)
+    , restore(NULL)
+    , huge_pages(false)
 {
     char* progname = argv[0];
     for (int i = 1; i < argc; ++i) {
@@ -128,12 +194,76 @@ Options::Options(int argc, char* argv[])
             stat_interval = (unsigned)get_num_arg(argv, i, 1, 10000);
         } else if (!strcmp(opt, "-flush-interval")) {
             flush_interval = (unsigned)get_num_arg(argv, i, 1, 10000);
+        } else if (!strcmp(opt, "-stat-format")) {
+            char* format = get_arg(argv, i);
+            if (!strcmp(format, "json")) {
+                stat_format = STAT_JSON;
+            } else if (!strcmp(format, "binary")) {
+                stat_format = STAT_BINARY;
+            } else if (!strcmp(format, "delta")) {
+                stat_format = STAT_BINARY_DELTA;
+            } else {
+                fprintf(stderr, "%s: Invalid statistics format '%s'\n",
+                    progname, format);
+                exit(EXIT_FAILURE);
+            }
+        } else if (!strcmp(opt, "-stat-file")) {
+            stat_file = get_arg(argv, i);
+        } else if (!strcmp(opt, "-stats-to-json")) {
+            char* file = get_arg(argv, i);
+            FILE* from = fopen(file, "rb");
+            if (!from || BinaryStats::convert_to_json(from, stdout) < 0) {
+                fprintf(stderr, "%s: Unable to convert statistics from '%s'\n",
+                    progname, file);
+                exit(EXIT_FAILURE);
+            }
+            fclose(from);
+            exit(EXIT_SUCCESS);
         } else if (!strcmp(opt, "-frame-delay")) {
             frame_delay = (unsigned)get_num_arg(argv, i, 0, 60000);
         } else if (!strcmp(opt, "-pixel-size")) {
             pixel_size = get_num_arg(argv, i, 1, 1000000);
         } else if (!strcmp(opt, "-max-threads")) {
             max_threads = (unsigned)get_num_arg(argv, i, 1, 10000);
+        } else if (!strcmp(opt, "-reference-fluids")) {
+            reference_fluids = true;
+        } else if (!strcmp(opt, "-gradient-fields")) {
+            gradient_fields = true;
+        } else if (!strcmp(opt, "-half-fluids")) {
+            half_fluids = true;
+        } else if (!strcmp(opt, "-print-thread-usage")) {
+            print_thread_usage = true;
+        } else if (!strcmp(opt, "-ticks")) {
+            ticks = (unsigned)get_num_arg(argv, i, 1, UINT_MAX);
+        } else if (!strcmp(opt, "-wait")) {
+            wait = true;
+        } else if (!strcmp(opt, "-no-wait")) {
+            wait = false;
+        } else if (!strcmp(opt, "-render-thread")) {
+            render_thread = true;
+        } else if (!strcmp(opt, "-frames-out")) {
+            frames_out = get_arg(argv, i);
+        } else if (!strcmp(opt, "-frame-interval")) {
+            frame_interval = (unsigned)get_num_arg(argv, i, 1, UINT_MAX);
+        } else if (!strcmp(opt, "-checkpoint")) {
+            checkpoint = get_arg(argv, i);
+        } else if (!strcmp(opt, "-checkpoint-every")) {
+            checkpoint_every = (unsigned)get_num_arg(argv, i, 1, UINT_MAX);
+        } else if (!strcmp(opt, "-restore")) {
+            restore = get_arg(argv, i);
+        } else if (!strcmp(opt, "-huge-pages")) {
+            huge_pages = true;
+        } else if (!strcmp(opt, "-frame-format")) {
+            char* format = get_arg(argv, i);
+            if (!strcmp(format, "y4m")) {
+                frame_format = FRAME_Y4M;
+            } else if (!strcmp(format, "ppm")) {
+                frame_format = FRAME_PPM;
+            } else {
+                fprintf(stderr, "%s: Invalid frame format '%s'\n", progname,
+                    format);
+                exit(EXIT_FAILURE);
+            }
         } else if (!strcmp(opt, "-help") || !strcmp(opt, "-h")) {
             print_help(progname);
             exit(EXIT_SUCCESS);
@@ -147,4 +277,13 @@ Options::Options(int argc, char* argv[])
             exit(EXIT_FAILURE);
         }
     }
+#ifndef ANOSMELLYA_SIMD_F16C
+    // Half precision has no effect with the reference code:
+    if (half_fluids && !reference_fluids) {
+        fprintf(stderr,
+            "%s: Warning: this build has no F16C instructions, so "
+            "-half-fluids is slower than the default\n",
+            progname);
+    }
+#endif
 }
@@ -2,6 +2,8 @@
 #define ANOSMELLYA_OPTIONS_H_
 
 #include "Config.hpp"
+#include "FrameWriter.hpp"
+#include "StatsWriter.hpp"
 #include <stdint.h>
 
 namespace anosmellya {
@@ -15,9 +17,25 @@ struct Options {
     bool print_stats;
     unsigned stat_interval;
     unsigned flush_interval; // 0 means no fflush calls
+    StatFormat stat_format;
+    const char* stat_file; // NULL means standard output
     unsigned frame_delay;
     int pixel_size;
     unsigned max_threads; // 0 means use the number of CPUs
+    bool reference_fluids;
+    bool gradient_fields;
+    bool half_fluids;
+    bool print_thread_usage;
+    unsigned ticks; // 0 means run until quit
+    bool wait;
+    bool render_thread;
+    const char* frames_out; // NULL means no frames, "-" standard output
+    unsigned frame_interval;
+    FrameFormat frame_format;
+    const char* checkpoint; // NULL means no checkpoints
+    unsigned checkpoint_every; // 0 means only when quitting
+    const char* restore; // NULL means start afresh
+    bool huge_pages;
 
     Options(int argc, char* argv[]);
 
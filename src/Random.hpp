@@ -3,33 +3,84 @@
 
 #include <stdint.h>
 
+// A counter-based generator. Each number is a function of the key and the
+// index of the draw, so generators for different keys are independent and
+// don't need to be advanced in any particular order. The key is usually made
+// from the seed, the tick, and the tile the numbers are for.
 class Random {
 public:
     static const uint32_t MAX_INT = 0xFFFFFFFF;
 
     Random(uint32_t seed)
-        : state(seed)
+        : key(make_key(seed))
+        , counter(0)
+    {
+    }
+
+    // Make the generator for a tile on a tick. Different cells on the same tick
+    // and the same cell on different ticks get unrelated numbers.
+    Random(uint32_t seed, uint64_t tick, uint64_t cell)
+        : key(make_key(mix(mix(seed) ^ tick) ^ cell))
+        , counter(0)
     {
     }
 
     Random& operator=(Random const& copy) = default;
 
-    uint32_t generate()
+    uint32_t generate() { return squares(counter++, key); }
+
+    float generate(float max) { return to_float(generate(), max); }
+
+    float generate_pos_neg(float max) { return generate(max * 2.) - max; }
+
+    // Fill the buffer with the next count numbers, each as if from
+    // generate(max). There are no dependencies between the iterations, so the
+    // buffer can be filled a vector at a time where the compiler manages it.
+    void generate(float* buf, unsigned count, float max)
+    {
+        for (unsigned i = 0; i < count; ++i) {
+            buf[i] = to_float(squares(counter + i, key), max);
+        }
+        counter += count;
+    }
+
+private:
+    uint64_t key;
+    // The index of the next draw:
+    uint64_t counter;
+
+    // https://arxiv.org/abs/2004.06278 (Squares: A Fast Counter-Based RNG)
+    static uint32_t squares(uint64_t ctr, uint64_t key)
     {
-        // https://en.wikipedia.org/wiki/Linear_congruential_generator (maybe?)
-        state = 1103515245 * state + 12345;
-        return state;
+        uint64_t x = ctr * key;
+        uint64_t y = x;
+        uint64_t z = y + key;
+        x = x * x + y;
+        x = (x >> 32) | (x << 32);
+        x = x * x + z;
+        x = (x >> 32) | (x << 32);
+        x = x * x + y;
+        x = (x >> 32) | (x << 32);
+        return (x * x + z) >> 32;
     }
 
-    float generate(float max)
+    static float to_float(uint32_t n, float max)
     {
-        return (float)generate() / (MAX_INT + 1.) * max;
+        return (float)n / (MAX_INT + 1.) * max;
     }
 
-    float generate_pos_neg(float max) { return generate(max * 2.) - max; }
+    // SplitMix64 finalizer, to spread the bits of keys around.
+    static uint64_t mix(uint64_t z)
+    {
+        z += 0x9E3779B97F4A7C15ULL;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
 
-private:
-    uint32_t state;
+    // Squares wants keys with plenty of set bits in both halves; an odd mixed
+    // value is good enough for this simulation.
+    static uint64_t make_key(uint64_t from) { return mix(from) | 1; }
 };
 
 #endif /* ANOSMELLYA_RANDOM_H_ */
@@ -0,0 +1,56 @@
+#include "Snapshot.hpp"
+
+using namespace anosmellya;
+
+const uint8_t anosmellya::look_colors[LOOK_COUNT][3]
+    = { { 0, 0, 255 }, { 255, 0, 0 }, { 0, 127, 255 }, { 255, 127, 0 } };
+
+Snapshot::Snapshot()
+    : width(0)
+    , height(0)
+    , smell_pixels()
+    , animals()
+    , affs()
+{
+}
+
+SnapshotBuffer::SnapshotBuffer()
+    : back(0)
+    , ready(1)
+    , front(2)
+    , fresh(false)
+    , lock(0)
+{
+}
+
+bool SnapshotBuffer::is_taken()
+{
+    SDL_AtomicLock(&lock);
+    bool taken = !fresh;
+    SDL_AtomicUnlock(&lock);
+    return taken;
+}
+
+void SnapshotBuffer::publish()
+{
+    SDL_AtomicLock(&lock);
+    unsigned tmp = back;
+    back = ready;
+    ready = tmp;
+    fresh = true;
+    SDL_AtomicUnlock(&lock);
+}
+
+Snapshot* SnapshotBuffer::take()
+{
+    SDL_AtomicLock(&lock);
+    bool taken = fresh;
+    if (fresh) {
+        unsigned tmp = front;
+        front = ready;
+        ready = tmp;
+        fresh = false;
+    }
+    SDL_AtomicUnlock(&lock);
+    return taken ? &snapshots[front] : NULL;
+}
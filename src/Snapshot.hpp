@@ -0,0 +1,82 @@
+#ifndef ANOSMELLYA_SNAPSHOT_H_
+#define ANOSMELLYA_SNAPSHOT_H_
+
+#include "Vec2D.hpp"
+#include <SDL2/SDL.h>
+#include <stdint.h>
+#include <vector>
+
+namespace anosmellya {
+
+// How an animal is colored when drawn.
+enum AnimalLook {
+    LOOK_HERB,
+    LOOK_CARN,
+    LOOK_RECEPTIVE_HERB,
+    LOOK_RECEPTIVE_CARN,
+    LOOK_COUNT
+};
+
+// The RGB color of each look:
+extern const uint8_t look_colors[LOOK_COUNT][3];
+
+// The smell affinity vectors of an animal, scaled for drawing.
+struct AffVectors {
+    Vec2D pos;
+    // Plant, herbivore, carnivore, baby, then velocity, in tiles:
+    Vec2D accs[5];
+};
+
+// Everything needed to draw the world as of one tick, so that the world can go
+// on ticking while it is drawn. Positions are in tiles.
+struct Snapshot {
+    unsigned width;
+    unsigned height;
+    // The smells as ARGB8888 pixels, row by row:
+    std::vector<uint32_t> smell_pixels;
+    // The centers of the animals with each look:
+    std::vector<Vec2D> animals[LOOK_COUNT];
+    // Empty unless affinities were asked for:
+    std::vector<AffVectors> affs;
+
+    Snapshot();
+};
+
+// Three snapshots for passing the world from a simulating thread to a drawing
+// thread without either waiting on the other. The simulating thread fills the
+// back snapshot and publishes it, swapping it with the ready one. The drawing
+// thread takes the ready one if it is new, swapping it with the front one.
+class SnapshotBuffer {
+public:
+    SnapshotBuffer();
+
+    // Get the snapshot to be filled by the simulating thread.
+    Snapshot& get_back() { return snapshots[back]; }
+
+    // Whether the last published snapshot has been taken, so that filling
+    // another would be worthwhile.
+    bool is_taken();
+
+    // Make the back snapshot the ready one.
+    void publish();
+
+    // Take the ready snapshot if it was published since the last take, and
+    // return it. Returns NULL if there is nothing new.
+    Snapshot* take();
+
+private:
+    SnapshotBuffer(SnapshotBuffer const& copy);
+    SnapshotBuffer& operator=(SnapshotBuffer const& copy);
+
+    Snapshot snapshots[3];
+    unsigned back;
+    unsigned ready;
+    unsigned front;
+    bool fresh;
+    // Guards ready and fresh:
+    SDL_SpinLock lock;
+};
+
+} /* namespace anosmellya */
+
+#endif /* ANOSMELLYA_SNAPSHOT_H_ */
@@ -0,0 +1,99 @@
+#include "StatsWriter.hpp"
+
+using namespace anosmellya;
+
+// NOTE: As in ThreadPool.cpp, fallible SDL calls are retried in empty loops.
+
+StatsWriter::StatsWriter(FILE* to, StatFormat format)
+    : to(to)
+    , format(format)
+    , binary(format == STAT_BINARY_DELTA ? BinaryStats::DELTA
+                                         : BinaryStats::PLAIN)
+    , head(0)
+    , tail(0)
+    , free_slots(SDL_CreateSemaphore(RING_SIZE))
+    , filled_slots(SDL_CreateSemaphore(0))
+    , thread(NULL)
+    , header_written(false)
+{
+    if (free_slots && filled_slots) {
+        thread = SDL_CreateThread(thread_proc, "stats", this);
+    }
+}
+
+StatsWriter::~StatsWriter()
+{
+    if (thread) {
+        Entry quit = { Statistics(), false, true, true };
+        push(quit);
+        SDL_WaitThread(thread, NULL);
+    } else {
+        fflush(to);
+    }
+    if (free_slots) {
+        SDL_DestroySemaphore(free_slots);
+    }
+    if (filled_slots) {
+        SDL_DestroySemaphore(filled_slots);
+    }
+}
+
+void StatsWriter::write(Statistics const& stats)
+{
+    Entry entry = { stats, true, false, false };
+    push(entry);
+}
+
+void StatsWriter::flush()
+{
+    Entry entry = { Statistics(), false, true, false };
+    push(entry);
+}
+
+void StatsWriter::push(Entry const& entry)
+{
+    if (!thread) {
+        handle(entry);
+        return;
+    }
+    while (SDL_SemWait(free_slots)) { }
+    ring[head] = entry;
+    head = (head + 1) % RING_SIZE;
+    while (SDL_SemPost(filled_slots)) { }
+}
+
+void StatsWriter::handle(Entry const& entry)
+{
+    if (entry.has_stats) {
+        if (format == STAT_JSON) {
+            Statistics stats = entry.stats;
+            stats.print(to);
+            fputc('\n', to);
+        } else {
+            if (!header_written) {
+                binary.write_header(to);
+                header_written = true;
+            }
+            binary.write(to, entry.stats);
+        }
+    }
+    if (entry.flush) {
+        fflush(to);
+    }
+}
+
+int StatsWriter::thread_proc(void* arg)
+{
+    StatsWriter* writer = (StatsWriter*)arg;
+    for (;;) {
+        while (SDL_SemWait(writer->filled_slots)) { }
+        Entry const& entry = writer->ring[writer->tail];
+        writer->handle(entry);
+        bool quit = entry.quit;
+        writer->tail = (writer->tail + 1) % RING_SIZE;
+        while (SDL_SemPost(writer->free_slots)) { }
+        if (quit) {
+            return 0;
+        }
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef ANOSMELLYA_STATS_WRITER_H_
+#define ANOSMELLYA_STATS_WRITER_H_
+
+#include "BinaryStats.hpp"
+#include "World.hpp"
+#include <SDL2/SDL.h>
+#include <stdio.h>
+
+namespace anosmellya {
+
+enum StatFormat { STAT_JSON, STAT_BINARY, STAT_BINARY_DELTA };
+
+// Writes statistics to a file on a thread of its own, so that formatting and
+// slow output don't hold up the simulation. Snapshots are passed through a
+// ring with one slot per snapshot. The ring has one writer and one reader, so
+// it needs no lock; a pair of semaphores counts the free and filled slots. If
+// the ring is full, write waits for the writer thread to catch up. If the
+// thread can't be created, statistics are written directly instead.
+class StatsWriter {
+public:
+    StatsWriter(FILE* to, StatFormat format);
+
+    // Finish writing everything that was queued.
+    ~StatsWriter();
+
+    // Queue a snapshot of the statistics to be written. In a binary format,
+    // the first is preceded by the header.
+    void write(Statistics const& stats);
+
+    // Queue a flush of the file after what was queued before.
+    void flush();
+
+private:
+    static const unsigned RING_SIZE = 64;
+
+    struct Entry {
+        Statistics stats;
+        bool has_stats;
+        bool flush;
+        bool quit;
+    };
+
+    StatsWriter(StatsWriter const& copy);
+    StatsWriter& operator=(StatsWriter const& copy);
+
+    static int thread_proc(void* arg);
+
+    void push(Entry const& entry);
+
+    void handle(Entry const& entry);
+
+    FILE* to;
+    StatFormat format;
+    BinaryStats binary;
+    Entry ring[RING_SIZE];
+    // The next slot to fill, only touched by the simulation thread:
+    unsigned head;
+    // The next slot to read, only touched by the writer thread:
+    unsigned tail;
+    SDL_sem* free_slots;
+    SDL_sem* filled_slots;
+    // NULL if statistics are written directly:
+    SDL_Thread* thread;
+    // The binary header is only written with the first record, so nothing is
+    // written if no statistics are:
+    bool header_written;
+};
+
+} /* namespace anosmellya */
+
+#endif /* ANOSMELLYA_STATS_WRITER_H_ */
@@ -0,0 +1,174 @@
+#include "ThreadPool.hpp"
+#include "platform.hpp"
+#include <stddef.h>
+
+using namespace anosmellya;
+
+static_assert(sizeof(ThreadUsage) == 64, "Thread usage must fill a cache line");
+// What keeps the counters of each thread in their own line:
+static_assert(alignof(max_align_t) >= 2 * sizeof(uint64_t),
+    "Thread usage counters must not straddle cache lines");
+
+// NOTE: As in World.cpp, fallible SDL calls are retried in empty loops.
+
+// How many times to check for work before going to sleep:
+#define SPIN_COUNT 4000
+
+ThreadUsage::ThreadUsage()
+    : busy(0)
+    , chunks(0)
+{
+}
+
+ThreadPool::ThreadPool(unsigned max_threads)
+    : threads()
+    , workers()
+    , usage()
+    , mutex(SDL_CreateMutex())
+    , start_cond(SDL_CreateCond())
+    , done_cond(SDL_CreateCond())
+    , chunk_count(0)
+    , func(NULL)
+    , ctx(NULL)
+    , created_at(SDL_GetPerformanceCounter())
+{
+    SDL_AtomicSet(&quit, 0);
+    SDL_AtomicSet(&generation, 0);
+    SDL_AtomicSet(&next_chunk, 0);
+    SDL_AtomicSet(&remaining, 0);
+    SDL_AtomicSet(&sleeping_workers, 0);
+    SDL_AtomicSet(&main_sleeping, 0);
+    if (!mutex || !start_cond || !done_cond) {
+        max_threads = 1;
+    }
+    // Worker structs are referenced by the threads, so they must not move:
+    workers.reserve(max_threads);
+    for (unsigned i = 1; i < max_threads; ++i) {
+        Worker worker = { this, (unsigned)threads.size() + 1 };
+        workers.push_back(worker);
+        SDL_Thread* thread = SDL_CreateThread(
+            worker_proc, "Anosmellya worker", &workers.back());
+        if (!thread) {
+            workers.pop_back();
+            break;
+        }
+        threads.push_back(thread);
+    }
+    usage.resize(threads.size() + 1);
+}
+
+ThreadPool::~ThreadPool()
+{
+    SDL_AtomicSet(&quit, 1);
+    SDL_AtomicAdd(&generation, 1);
+    if (!threads.empty()) {
+        while (SDL_LockMutex(mutex)) { }
+        while (SDL_CondBroadcast(start_cond)) { }
+        SDL_UnlockMutex(mutex);
+    }
+    for (unsigned i = 0; i < threads.size(); ++i) {
+        SDL_WaitThread(threads[i], NULL);
+    }
+    SDL_DestroyCond(done_cond);
+    SDL_DestroyCond(start_cond);
+    SDL_DestroyMutex(mutex);
+}
+
+void ThreadPool::do_chunks(unsigned thread)
+{
+    ThreadUsage& use = usage[thread];
+    uint64_t start = SDL_GetPerformanceCounter();
+    for (;;) {
+        unsigned chunk = SDL_AtomicAdd(&next_chunk, 1);
+        if (chunk >= chunk_count) {
+            break;
+        }
+        func(chunk, thread, ctx);
+        ++use.chunks;
+    }
+    use.busy += SDL_GetPerformanceCounter() - start;
+}
+
+void ThreadPool::run(
+    unsigned chunk_count, void (*func)(unsigned, unsigned, void*), void* ctx)
+{
+    this->chunk_count = chunk_count;
+    this->func = func;
+    this->ctx = ctx;
+    SDL_AtomicSet(&next_chunk, 0);
+    SDL_AtomicSet(&remaining, threads.size());
+    // The atomic operations are full barriers, so the sleeping count read here
+    // is up to date with respect to the new generation. Any worker which goes
+    // to sleep later will see the new generation first.
+    SDL_AtomicAdd(&generation, 1);
+    if (SDL_AtomicGet(&sleeping_workers) > 0) {
+        while (SDL_LockMutex(mutex)) { }
+        while (SDL_CondBroadcast(start_cond)) { }
+        SDL_UnlockMutex(mutex);
+    }
+    do_chunks(0);
+    for (unsigned spin = 0; SDL_AtomicGet(&remaining) > 0; ++spin) {
+        if (spin < SPIN_COUNT) {
+            ANOSMELLYA_CPU_PAUSE();
+            continue;
+        }
+        while (SDL_LockMutex(mutex)) { }
+        SDL_AtomicSet(&main_sleeping, 1);
+        while (SDL_AtomicGet(&remaining) > 0) {
+            SDL_CondWait(done_cond, mutex);
+        }
+        SDL_AtomicSet(&main_sleeping, 0);
+        SDL_UnlockMutex(mutex);
+    }
+}
+
+int ThreadPool::worker_proc(void* arg)
+{
+    Worker* worker = (Worker*)arg;
+    ThreadPool* pool = worker->pool;
+    int seen = 0;
+    for (;;) {
+        int gen = SDL_AtomicGet(&pool->generation);
+        for (unsigned spin = 0; gen == seen && spin < SPIN_COUNT; ++spin) {
+            ANOSMELLYA_CPU_PAUSE();
+            gen = SDL_AtomicGet(&pool->generation);
+        }
+        if (gen == seen) {
+            while (SDL_LockMutex(pool->mutex)) { }
+            SDL_AtomicAdd(&pool->sleeping_workers, 1);
+            while ((gen = SDL_AtomicGet(&pool->generation)) == seen) {
+                SDL_CondWait(pool->start_cond, pool->mutex);
+            }
+            SDL_AtomicAdd(&pool->sleeping_workers, -1);
+            SDL_UnlockMutex(pool->mutex);
+        }
+        if (SDL_AtomicGet(&pool->quit)) {
+            break;
+        }
+        seen = gen;
+        pool->do_chunks(worker->index);
+        if (SDL_AtomicAdd(&pool->remaining, -1) == 1
+            && SDL_AtomicGet(&pool->main_sleeping)) {
+            while (SDL_LockMutex(pool->mutex)) { }
+            while (SDL_CondSignal(pool->done_cond)) { }
+            SDL_UnlockMutex(pool->mutex);
+        }
+    }
+    return 0;
+}
+
+void ThreadPool::print_usage(FILE* to)
+{
+    double freq = SDL_GetPerformanceFrequency();
+    double elapsed = (SDL_GetPerformanceCounter() - created_at) / freq;
+    fprintf(to, "{\"elapsed\":%f,\"threads\":[", elapsed);
+    for (unsigned i = 0; i < usage.size(); ++i) {
+        double busy = usage[i].busy / freq;
+        fprintf(to,
+            "%s{\"busy\":%f,\"utilization\":%f,\"chunks\":"
+            "%" ANOSMELLYA_UINT64_FMT "}",
+            i > 0 ? "," : "", busy, elapsed > 0. ? busy / elapsed : 0.,
+            usage[i].chunks);
+    }
+    fputs("]}", to);
+}
@@ -0,0 +1,93 @@
+#ifndef ANOSMELLYA_THREAD_POOL_H_
+#define ANOSMELLYA_THREAD_POOL_H_
+
+#include <SDL2/SDL.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+namespace anosmellya {
+
+// Time spent by one thread of a pool on chunks since the pool was created.
+// Each is padded to the size of a cache line so that threads don't slow each
+// other down when updating their own counters. The vector holding them doesn't
+// honour extended alignment, but its storage is at least 16-byte aligned, so
+// the 16 bytes of counters never straddle a line and each set gets its own.
+struct ThreadUsage {
+    uint64_t busy; // In performance counter units
+    uint64_t chunks;
+    char padding[64 - 2 * sizeof(uint64_t)];
+
+    ThreadUsage();
+};
+
+// A set of persistent threads which run chunked parallel loops. Thread 0 is
+// the thread calling run, which does chunks alongside the others. Idle workers
+// spin for a short while waiting for the next loop, since loops usually come in
+// quick succession during a tick, then sleep on a condition variable (a futex
+// on Linux.) Loops can't be nested. The pool can't be moved once created.
+class ThreadPool {
+public:
+    // Create a pool with up to max_threads threads in total. If creating a
+    // thread fails, the pool just has fewer.
+    ThreadPool(unsigned max_threads);
+
+    ~ThreadPool();
+
+    unsigned get_thread_count() { return usage.size(); }
+
+    // Call func(chunk, thread) for each chunk from 0 to chunk_count - 1, where
+    // thread is the index of the calling thread. Chunks are handed out in
+    // order, but may finish in any order. Returns when all chunks are done.
+    template <typename F> void run(unsigned chunk_count, F& func)
+    {
+        run(chunk_count, call<F>, &func);
+    }
+
+    void run(unsigned chunk_count, void (*func)(unsigned, unsigned, void*),
+        void* ctx);
+
+    // Print the usage of each thread as JSON to the file.
+    void print_usage(FILE* to);
+
+private:
+    template <typename F>
+    static void call(unsigned chunk, unsigned thread, void* func)
+    {
+        (*(F*)func)(chunk, thread);
+    }
+
+    struct Worker {
+        ThreadPool* pool;
+        unsigned index;
+    };
+
+    static int worker_proc(void* arg);
+
+    void do_chunks(unsigned thread);
+
+    std::vector<SDL_Thread*> threads;
+    std::vector<Worker> workers;
+    std::vector<ThreadUsage> usage;
+    SDL_mutex* mutex;
+    // Signalled when a new loop starts:
+    SDL_cond* start_cond;
+    // Signalled when the last worker finishes a loop:
+    SDL_cond* done_cond;
+    // Incremented to start a new loop or to wake workers for shutdown:
+    SDL_atomic_t generation;
+    SDL_atomic_t quit;
+    SDL_atomic_t next_chunk;
+    // The number of workers that haven't finished the current loop yet:
+    SDL_atomic_t remaining;
+    SDL_atomic_t sleeping_workers;
+    SDL_atomic_t main_sleeping;
+    unsigned chunk_count;
+    void (*func)(unsigned, unsigned, void*);
+    void* ctx;
+    uint64_t created_at;
+};
+
+} /* namespace anosmellya */
+
+#endif /* ANOSMELLYA_THREAD_POOL_H_ */
@@ -1,84 +1,150 @@
 #include "World.hpp"
 #include "platform.hpp"
-#include <limits.h>
+#include "simd.hpp"
 #include <math.h>
 
 using namespace anosmellya;
 
-// NOTE: I put empty while loops around fallible SDL calls because I don't want
-// a crash, but those failures seem unlikely. If I see a hang, I will reconsider
-// this decision. Thread creation failure is also ignored (the program just runs
-// a bit slower.)
+// The minimum height of a band of fluid rows given to a thread:
+#define MIN_BAND_ROWS 8
 
-static int worker_proc(void* arg);
+// The height of a strip of animals ticked by one thread. This doesn't depend
+// on the number of threads so that the results don't either.
+#define STRIP_ROWS 16
+// How far an animal in a strip can reach beyond it. Strips ticked at the same
+// time are one strip apart, so this is half the height of a strip.
+#define STRIP_MARGIN (STRIP_ROWS / 2)
 
-World::World(unsigned width, unsigned height, Random const& random,
-    Config const& conf, unsigned max_threads)
-    : random(random)
-    , conf(conf)
-    , tick(0)
-    , animal(width, height)
-    , plant(width, height, 0.)
-    , herb(width, height, 0.)
-    , carn(width, height, 0.)
-    , baby(width, height, 0.)
-    , carn_rect_buf()
-    , herb_rect_buf()
-    , receptive_carn_rect_buf()
-    , receptive_herb_rect_buf()
-    , workers()
+static unsigned count_threads(unsigned max_threads)
 {
     if (max_threads == 0) {
         int cpu_count = SDL_GetCPUCount();
-        max_threads = cpu_count > 0 ? (unsigned)cpu_count : UINT_MAX;
-    }
-    // Make up to max_threads - 1 workers and mark unused workers as such:
-    for (unsigned i = 0; i < sizeof(workers) / sizeof(*workers); ++i) {
-        // If creation fails, this worker won't be used:
-        workers[i].thread = NULL;
-        if (max_threads > 1) {
-            workers[i].start_sem = SDL_CreateSemaphore(0);
-            if (workers[i].start_sem) {
-                workers[i].stop_sem = SDL_CreateSemaphore(0);
-                if (workers[i].stop_sem) {
-                    workers[i].thread = SDL_CreateThread(
-                        worker_proc, "Anosmellya fluid worker", &workers[i]);
-                    if (workers[i].thread) {
-                        --max_threads;
-                        continue;
-                    }
-                    SDL_DestroySemaphore(workers[i].stop_sem);
-                }
-                SDL_DestroySemaphore(workers[i].start_sem);
-            }
+        // Four threads was the old maximum, so it seems like a safe guess:
+        max_threads = cpu_count > 0 ? (unsigned)cpu_count : 4;
+    }
+    return max_threads;
+}
+
+// The reference kernel ticks every tile, so quiet blocks aren't tracked for it.
+static float skip_threshold(Config const& conf, bool reference_fluids)
+{
+    return reference_fluids ? 0. : conf.skip_threshold;
+}
+
+StatChanges::StatChanges()
+    : herb_animals()
+    , carn_animals()
+    , plant(0.)
+    , herb(0.)
+    , carn(0.)
+    , baby(0.)
+{
+}
+
+PhaseTimes::PhaseTimes()
+    : fluids(0)
+    , animals(0)
+    , plants(0)
+    , stats(0)
+{
+}
+
+World::World(unsigned width, unsigned height, uint32_t seed,
+    Config const& conf, unsigned max_threads, bool reference_fluids,
+    bool gradient_fields, bool half_fluids)
+    : seed(seed)
+    , conf(conf)
+    , tick(0)
+    , animal(width, height, 0, NULL)
+    , genomes(width * height)
+    , occupied(width, height)
+    , plant(width, height, conf.plant_dispersal, conf.plant_evap,
+          gradient_fields, skip_threshold(conf, reference_fluids),
+          half_fluids && !reference_fluids)
+    , herb(width, height, conf.herb_dispersal, conf.herb_evap,
+          gradient_fields, skip_threshold(conf, reference_fluids),
+          half_fluids && !reference_fluids)
+    , carn(width, height, conf.carn_dispersal, conf.carn_evap,
+          gradient_fields, skip_threshold(conf, reference_fluids),
+          half_fluids && !reference_fluids)
+    , baby(width, height, conf.baby_dispersal, conf.baby_evap,
+          gradient_fields, skip_threshold(conf, reference_fluids),
+          half_fluids && !reference_fluids)
+    , herb_totals()
+    , carn_totals()
+    , reference_fluids(reference_fluids)
+    , pool(count_threads(max_threads))
+    , fluid_jobs()
+    , fluid_scratch(pool.get_thread_count())
+    , animal_strips()
+    , phase_times()
+    , aff_bands()
+{
+    for (unsigned i = 0; i < fluid_scratch.size(); ++i) {
+        fluid_scratch[i].resize(plant.scratch_size());
+    }
+    // Split the fluids into bands so that each thread gets several:
+    unsigned band_rows = height / pool.get_thread_count();
+    if (band_rows < MIN_BAND_ROWS) {
+        band_rows = MIN_BAND_ROWS;
+    }
+    Fluid* fluids[] = { &plant, &herb, &carn, &baby };
+    for (unsigned i = 0; i < sizeof(fluids) / sizeof(*fluids); ++i) {
+        if (reference_fluids) {
+            FluidJob job = { fluids[i], 0, height };
+            fluid_jobs.push_back(job);
+            continue;
+        }
+        for (unsigned start = 0; start < height; start += band_rows) {
+            unsigned end
+                = start + band_rows < height ? start + band_rows : height;
+            FluidJob job = { fluids[i], start, end };
+            fluid_jobs.push_back(job);
         }
     }
+    // Alternate strips between two phases. Since the world wraps, an odd last
+    // strip needs a phase of its own.
+    unsigned strip_count = height / STRIP_ROWS > 0 ? height / STRIP_ROWS : 1;
+    animal_strips.resize(strip_count);
+    for (unsigned i = 0; i < strip_count; ++i) {
+        AnimalStrip& strip = animal_strips[i];
+        strip.start = i * STRIP_ROWS;
+        strip.end = i + 1 < strip_count ? strip.start + STRIP_ROWS : height;
+        strip.phase = i % 2;
+        if (strip_count > 1 && strip_count % 2 == 1 && i + 1 == strip_count) {
+            strip.phase = 2;
+        }
+        phase_strips[strip.phase].push_back(i);
+    }
+    // The grids are first written to here, in the bands they are ticked in,
+    // so that their memory is spread across the threads that use it.
+    auto touch_fluid = [this](unsigned i, unsigned) {
+        FluidJob& job = fluid_jobs[i];
+        job.fluid->clear_rows(job.start, job.end);
+    };
+    pool.run(fluid_jobs.size(), touch_fluid);
+    auto touch_animals = [this](unsigned i, unsigned) {
+        AnimalStrip& strip = animal_strips[i];
+        animal.fill_rows(strip.start, strip.end, Animal());
+    };
+    pool.run(animal_strips.size(), touch_animals);
     for (unsigned y = 0; y < height; ++y) {
         for (unsigned x = 0; x < width; ++x) {
-            Animal an;
-            if (conf.initial_animal_chance > this->random.generate(1.)) {
-                if (conf.initial_carn_chance > this->random.generate(1.)) {
-                    an.be_carn();
+            Random random(seed, 0, (uint64_t)y * width + x);
+            if (conf.initial_animal_chance > random.generate(1.)) {
+                Genome genome;
+                if (conf.initial_carn_chance > random.generate(1.)) {
+                    genome.be_carn();
                 } else {
-                    an.be_herb();
+                    genome.be_herb();
                 }
-                an.pos = Vec2D(x + 0.5, y + 0.5);
-                an.mutate(this->random, conf.initial_variation);
+                genome.mutate(random, conf.initial_variation);
+                Animal& an = animal.at(x, y);
+                an = Animal(genomes.add(genome), genome,
+                    Vec2D(x + 0.5, y + 0.5), Vec2D(0., 0.), 100.);
+                occupied.set(x, y);
+                (an.is_carn ? carn_totals : herb_totals).add(an, genome);
             }
-            animal.at(x, y) = an;
-        }
-    }
-}
-
-World::~World()
-{
-    for (unsigned i = 0; i < sizeof(workers) / sizeof(*workers); ++i) {
-        if (workers[i].thread) {
-            workers[i].grid = NULL;
-            while (SDL_SemPost(workers[i].start_sem)) { }
-            SDL_WaitThread(workers[i].thread, NULL);
-            SDL_DestroySemaphore(workers[i].start_sem);
-            SDL_DestroySemaphore(workers[i].stop_sem);
         }
     }
 }
@@ -87,37 +153,7 @@ unsigned World::get_width() { return animal.get_width(); }
 
 unsigned World::get_height() { return animal.get_height(); }
 
-unsigned World::get_tick() { return tick; }
-
-static float flow(float a, float b, float portion) { return (b - a) * portion; }
-
-static void disperse(Grid<float>& grid, float portion)
-{
-    // This flow is not completely symmetrical, but it's good enough.
-    for (unsigned y = 0; y < grid.get_height(); ++y) {
-        for (unsigned x = 0; x < grid.get_width(); ++x) {
-            float& here = grid.at(x, y);
-            float& right = grid.at_small_trans(x, y, 1, 0);
-            float& below = grid.at_small_trans(x, y, 0, 1);
-            float flow_right = flow(here, right, portion);
-            float flow_below = flow(here, below, portion);
-            here += flow_right;
-            right -= flow_right;
-            here += flow_below;
-            below -= flow_below;
-        }
-    }
-}
-
-static void evaporate(Grid<float>& grid, float portion)
-{
-    float keep = 1. - portion;
-    for (unsigned y = 0; y < grid.get_height(); ++y) {
-        for (unsigned x = 0; x < grid.get_width(); ++x) {
-            grid.at(x, y) *= keep;
-        }
-    }
-}
+uint64_t World::get_tick() { return tick; }
 
 static void wrap(float& x, unsigned window)
 {
@@ -127,17 +163,6 @@ static void wrap(float& x, unsigned window)
     }
 }
 
-static Vec2D get_smell(Grid<float>& grid, unsigned x, unsigned y)
-{
-    float right = grid.at_small_trans(x, y, 1, 0);
-    float above = grid.at_small_trans(x, y, 0, -1);
-    float left = grid.at_small_trans(x, y, -1, 0);
-    float below = grid.at_small_trans(x, y, 0, 1);
-    float horizontal = right - left;
-    float vertical = below - above;
-    return Vec2D(horizontal, vertical);
-}
-
 static void add_output_impulse(Vec2D& acc, Vec2D input,
     SmellAffinity const& aff, float plant, float carn, float herb, float baby,
     float food)
@@ -163,85 +188,133 @@ static bool is_receptive(Animal const& an)
     return an.food >= an.baby_threshold;
 }
 
-static bool find_empty_space(Grid<Animal>& animal, unsigned& x, unsigned& y)
+// Look for an empty tile next to (x, y), trying right, above, left, then below.
+static bool find_empty_space(
+    Grid<Animal>& animal, Occupancy& occupied, unsigned& x, unsigned& y)
 {
-    unsigned tx = x;
-    unsigned ty = y;
-    animal.small_trans(tx, ty, 1, 0);
-    if (!animal.at(tx, ty).is_present) {
-        goto found;
-    }
-    animal.small_trans(tx, ty, -1, -1);
-    if (!animal.at(tx, ty).is_present) {
-        goto found;
-    }
-    animal.small_trans(tx, ty, -1, 1);
-    if (!animal.at(tx, ty).is_present) {
-        goto found;
-    }
-    animal.small_trans(tx, ty, 1, 1);
-    if (!animal.at(tx, ty).is_present) {
-    found:
-        x = tx;
-        y = ty;
-        return true;
+    unsigned width = animal.get_width();
+    unsigned height = animal.get_height();
+    unsigned right = x + 1 < width ? x + 1 : 0;
+    unsigned left = x > 0 ? x - 1 : width - 1;
+    unsigned above = y > 0 ? y - 1 : height - 1;
+    unsigned below = y + 1 < height ? y + 1 : 0;
+    unsigned xs[] = { right, x, left, x };
+    unsigned ys[] = { y, above, y, below };
+    for (unsigned i = 0; i < 4; ++i) {
+        if (!occupied.get(xs[i], ys[i])) {
+            x = xs[i];
+            y = ys[i];
+            return true;
+        }
     }
     return false;
 }
 
-static void make_baby(Random& random, Config const& conf, Grid<Animal>& animal,
+// Make a baby next to the mother if there is room. The baby has a random mix
+// of its parents' genes and the mother's velocity. Its starting food is the
+// minimum of the mother's food and her baby food, or zero if that would be
+// negative, and is taken from the mother. The baby is returned, or NULL if
+// there was no room.
+static Animal* make_baby(Random& random, Config const& conf,
+    Grid<Animal>& animal, GenomePool& genomes, Occupancy& occupied,
     unsigned mom_x, unsigned mom_y, Animal& dad)
 {
     unsigned kid_x = mom_x;
     unsigned kid_y = mom_y;
-    if (find_empty_space(animal, kid_x, kid_y)) {
+    if (find_empty_space(animal, occupied, kid_x, kid_y)) {
         Animal& mom = animal.at(mom_x, mom_y);
-        Animal kid(random, mom, dad);
-        mom.food -= kid.food;
+        Genome& mom_genome = genomes.at(mom.genome);
+        Genome genome(random, mom_genome, genomes.at(dad.genome));
         if (conf.mutate_chance > random.generate(1.)) {
-            kid.mutate(random, conf.mutate_amount);
+            genome.mutate(random, conf.mutate_amount);
         }
-        kid.pos = Vec2D(kid_x + 0.5, kid_y + 0.5);
-        kid.just_moved = kid_y > mom_y || kid_x > mom_x;
-        animal.at(kid_x, kid_y) = kid;
+        float food = fmaxf(0., fminf(mom_genome.baby_food, mom.food));
+        mom.food -= food;
+        Animal& placed = animal.at(kid_x, kid_y);
+        placed = Animal(genomes.add(genome), genome,
+            Vec2D(kid_x + 0.5, kid_y + 0.5), mom.vel, food);
+        occupied.set(kid_x, kid_y);
+        return &placed;
+    }
+    return NULL;
+}
+
+static AnimalTotals& totals_of(StatChanges& changes, Animal const& an)
+{
+    return an.is_carn ? changes.carn_animals : changes.herb_animals;
+}
+
+unsigned World::strip_of(unsigned y)
+{
+    unsigned strip = y / STRIP_ROWS;
+    return strip < animal_strips.size() ? strip : animal_strips.size() - 1;
+}
+
+bool World::is_ticked_after(
+    unsigned x, unsigned y, unsigned tx, unsigned ty, bool deferred)
+{
+    if (deferred) {
+        return false;
+    }
+    AnimalStrip& strip = animal_strips[strip_of(y)];
+    AnimalStrip& target_strip = animal_strips[strip_of(ty)];
+    if (&strip != &target_strip) {
+        return target_strip.phase > strip.phase;
     }
+    return ty > y || (ty == y && tx > x);
 }
 
-static void tick_animal(Random& random, Config const& conf, unsigned x,
-    unsigned y, Grid<Animal>& animal, Grid<float>& plant, Grid<float>& carn,
-    Grid<float>& herb, Grid<float>& baby)
+// Whether an animal in the strip at row y can interact with row ty without
+// reaching anything another strip ticking at the same time could touch. Babies
+// can be placed one row beyond the parent.
+static bool is_in_reach(AnimalStrip& strip, unsigned y, unsigned ty, int height)
+{
+    int dy = (int)ty - (int)y;
+    if (dy > height / 2) {
+        dy -= height;
+    } else if (dy < -height / 2) {
+        dy += height;
+    }
+    int row = (int)y + dy;
+    return row - 1 >= (int)strip.start - STRIP_MARGIN
+        && row + 1 < (int)strip.end + STRIP_MARGIN;
+}
+
+void World::tick_animal(unsigned x, unsigned y, AnimalStrip& strip)
 {
     unsigned width = animal.get_width();
     unsigned height = animal.get_height();
     Animal& an = animal.at(x, y);
-    if (!an.is_present) {
-        return;
-    }
     if (an.just_moved) {
         an.just_moved = false;
         return;
     }
     ++an.age;
     --an.food;
+    AnimalTotals& totals = totals_of(strip.changes, an);
+    ++totals.age;
     if (an.age >= conf.lifespan || !(an.food >= 0.)) {
-        an.is_present = false;
+        totals.remove(an, genomes.at(an.genome));
+        genomes.remove(an.genome);
+        occupied.clear(x, y);
         return;
     }
+    Genome const& genome = genomes.at(an.genome);
     Vec2D pos_orig = an.pos;
     Vec2D acc(0., 0.);
     float plant_here = plant.at(x, y);
     float carn_here = carn.at(x, y);
     float herb_here = herb.at(x, y);
     float baby_here = baby.at(x, y);
-    add_output_impulse(acc, get_smell(plant, x, y), an.plant_aff, plant_here,
+    add_output_impulse(acc, plant.gradient_at(x, y), genome.plant_aff,
+        plant_here, carn_here, herb_here, baby_here, an.food);
+    add_output_impulse(acc, carn.gradient_at(x, y), genome.carn_aff, plant_here,
         carn_here, herb_here, baby_here, an.food);
-    add_output_impulse(acc, get_smell(carn, x, y), an.carn_aff, plant_here,
+    add_output_impulse(acc, herb.gradient_at(x, y), genome.herb_aff, plant_here,
         carn_here, herb_here, baby_here, an.food);
-    add_output_impulse(acc, get_smell(herb, x, y), an.herb_aff, plant_here,
+    add_output_impulse(acc, baby.gradient_at(x, y), genome.baby_aff, plant_here,
         carn_here, herb_here, baby_here, an.food);
-    add_output_impulse(acc, get_smell(baby, x, y), an.baby_aff, plant_here,
-        carn_here, herb_here, baby_here, an.food);
-    add_output_impulse(acc, an.vel, an.vel_aff, plant_here, carn_here,
+    add_output_impulse(acc, an.vel, genome.vel_aff, plant_here, carn_here,
         herb_here, baby_here, an.food);
     float acc_divisor = hypot(acc.x, acc.y);
     if (acc_divisor != 0.) {
@@ -254,23 +327,48 @@ static void tick_animal(Random& random, Config const& conf, unsigned x,
     an.pos.y += an.vel.y;
     wrap(an.pos.x, width);
     wrap(an.pos.y, height);
+    AnimalMove move = { x, y, pos_orig };
+    if (animal_strips.size() > 1) {
+        // Prevent weird issues I have encountered, and handle NaN/Infinity:
+        unsigned ty = an.pos.y < height ? an.pos.y : height - 1;
+        if (!is_in_reach(strip, y, ty, height)) {
+            strip.deferred.push_back(move);
+            return;
+        }
+    }
+    move_animal(move, strip.changes, false);
+}
+
+void World::move_animal(
+    AnimalMove const& move, StatChanges& changes, bool deferred)
+{
+    unsigned width = animal.get_width();
+    unsigned height = animal.get_height();
+    unsigned x = move.x;
+    unsigned y = move.y;
+    Animal& an = animal.at(x, y);
     // Prevent weird issues I have encountered, and handle NaN/Infinity:
     unsigned tx = an.pos.x < width ? an.pos.x : width - 1;
     unsigned ty = an.pos.y < height ? an.pos.y : height - 1;
     if (is_receptive(an)) {
-        baby.at(tx, ty) += an.baby_smell_amount;
+        float amount = genomes.at(an.genome).baby_smell_amount;
+        baby.add(tx, ty, amount);
+        changes.baby += amount;
     }
     if (an.is_carn) {
-        carn.at(tx, ty) += conf.carn_amount;
+        carn.add(tx, ty, conf.carn_amount);
+        changes.carn += conf.carn_amount;
     } else {
         float eat = plant.at(tx, ty) * conf.herb_eat_portion;
         an.food += eat * conf.herb_efficiency;
-        plant.at(tx, ty) -= eat;
-        herb.at(tx, ty) += conf.herb_amount;
+        plant.add(tx, ty, -eat);
+        changes.plant -= eat;
+        herb.add(tx, ty, conf.herb_amount);
+        changes.herb += conf.herb_amount;
     }
     if (tx != x || ty != y) {
         Animal& target = animal.at(tx, ty);
-        if (target.is_present) {
+        if (occupied.get(tx, ty)) {
             if (an.is_carn && !target.is_carn) {
                 float eat = target.food * conf.carn_eat_portion;
                 an.food += eat * conf.carn_efficiency;
@@ -280,105 +378,108 @@ static void tick_animal(Random& random, Config const& conf, unsigned x,
                 target.food += eat * conf.carn_efficiency;
                 an.food -= eat;
             } else {
+                Animal* kid = NULL;
+                // Only one animal moves from a tile per tick, so the tile's
+                // generator is used at most once:
+                Random random(seed, tick, (uint64_t)y * width + x);
                 if (is_receptive(target)) {
-                    make_baby(random, conf, animal, tx, ty, an);
+                    kid = make_baby(random, conf, animal, genomes, occupied,
+                        tx, ty, an);
                 } else if (is_receptive(an)) {
-                    make_baby(random, conf, animal, x, y, target);
+                    kid = make_baby(random, conf, animal, genomes, occupied,
+                        x, y, target);
+                }
+                if (kid) {
+                    kid->just_moved = is_ticked_after(
+                        x, y, kid->pos.x, kid->pos.y, deferred);
+                    totals_of(changes, *kid).add(
+                        *kid, genomes.at(kid->genome));
                 }
             }
-            an.pos = pos_orig;
+            an.pos = move.pos_orig;
             an.vel = Vec2D(
                 (an.vel.x + target.vel.x) / 2., (an.vel.y + target.vel.y) / 2.);
             target.vel = an.vel;
         } else {
             target = an;
-            target.just_moved = ty > y || tx > x;
-            an.is_present = false;
-        }
-    }
-}
-
-static int worker_proc(void* arg)
-{
-    FluidWorker* worker = (FluidWorker*)arg;
-    for (;;) {
-        while (SDL_SemWait(worker->start_sem)) { }
-        if (!worker->grid) {
-            break;
+            target.just_moved = is_ticked_after(x, y, tx, ty, deferred);
+            occupied.set(tx, ty);
+            occupied.clear(x, y);
         }
-        disperse(*worker->grid, worker->dispersal);
-        evaporate(*worker->grid, worker->evap);
-        while (SDL_SemPost(worker->stop_sem)) { }
     }
-    return 0;
 }
 
 void World::simulate()
 {
     ++tick;
-    FluidWorker& plant_worker = workers[0];
-    FluidWorker& herb_worker = workers[1];
-    FluidWorker& carn_worker = workers[2];
-    // Set available workers working:
-    if (plant_worker.thread) {
-        plant_worker.grid = &plant;
-        plant_worker.evap = conf.plant_evap;
-        plant_worker.dispersal = conf.plant_dispersal;
-        while (SDL_SemPost(plant_worker.start_sem)) { }
-    }
-    if (herb_worker.thread) {
-        herb_worker.grid = &herb;
-        herb_worker.evap = conf.herb_evap;
-        herb_worker.dispersal = conf.herb_dispersal;
-        while (SDL_SemPost(herb_worker.start_sem)) { }
-    }
-    if (carn_worker.thread) {
-        carn_worker.grid = &carn;
-        carn_worker.evap = conf.carn_evap;
-        carn_worker.dispersal = conf.carn_dispersal;
-        while (SDL_SemPost(carn_worker.start_sem)) { }
-    }
-    // If workers don't exist to do the work, do it on the main thread:
-    if (!plant_worker.thread) {
-        disperse(plant, conf.plant_dispersal);
-        evaporate(plant, conf.plant_evap);
-    }
-    if (!herb_worker.thread) {
-        disperse(herb, conf.herb_dispersal);
-        evaporate(herb, conf.herb_evap);
-    }
-    if (!carn_worker.thread) {
-        disperse(carn, conf.carn_dispersal);
-        evaporate(carn, conf.carn_evap);
-    }
-    // The main thread is always utilized to do baby fluid simulation:
-    disperse(baby, conf.baby_dispersal);
-    evaporate(baby, conf.baby_evap);
-    // Wait for other calculations to finish:
-    if (plant_worker.thread) {
-        while (SDL_SemWait(plant_worker.stop_sem)) { }
-    }
-    if (herb_worker.thread) {
-        while (SDL_SemWait(herb_worker.stop_sem)) { }
-    }
-    if (carn_worker.thread) {
-        while (SDL_SemWait(carn_worker.stop_sem)) { }
-    }
-    // Now the animals:
-    for (unsigned y = 0; y < get_height(); ++y) {
-        for (unsigned x = 0; x < get_width(); ++x) {
-            tick_animal(random, conf, x, y, animal, plant, carn, herb, baby);
+    uint64_t start = SDL_GetPerformanceCounter();
+    auto do_fluid_job = [this](unsigned i, unsigned thread) {
+        FluidJob& job = fluid_jobs[i];
+        if (reference_fluids) {
+            job.fluid->tick_reference();
+            if (job.fluid->has_gradient()) {
+                job.fluid->find_gradient(0, job.fluid->get_height());
+            }
+        } else {
+            job.fluid->tick_rows(
+                job.start, job.end, fluid_scratch[thread].data());
         }
-    }
-    // And place some plant matter:
+    };
+    pool.run(fluid_jobs.size(), do_fluid_job);
+    if (!reference_fluids) {
+        plant.finish_tick();
+        herb.finish_tick();
+        carn.finish_tick();
+        baby.finish_tick();
+    }
+    uint64_t fluids_done = SDL_GetPerformanceCounter();
+    phase_times.fluids += fluids_done - start;
+    // Now the animals, one phase of strips at a time:
+    for (unsigned phase = 0; phase < 3; ++phase) {
+        std::vector<unsigned>& strips = phase_strips[phase];
+        auto do_strip = [this, &strips](unsigned i, unsigned) {
+            AnimalStrip& strip = animal_strips[strips[i]];
+            for (unsigned y = strip.start; y < strip.end; ++y) {
+                // Animals moving ahead in the row are picked up since the
+                // next one is looked for after each tick:
+                for (unsigned x = occupied.next(0, y); x < get_width();
+                     x = occupied.next(x + 1, y)) {
+                    tick_animal(x, y, strip);
+                }
+            }
+        };
+        pool.run(strips.size(), do_strip);
+    }
+    // Then the moves that reached too far to do in parallel, and the changes
+    // to the statistics:
+    for (unsigned i = 0; i < animal_strips.size(); ++i) {
+        AnimalStrip& strip = animal_strips[i];
+        for (unsigned j = 0; j < strip.deferred.size(); ++j) {
+            move_animal(strip.deferred[j], strip.changes, true);
+        }
+        strip.deferred.clear();
+        herb_totals.add(strip.changes.herb_animals);
+        carn_totals.add(strip.changes.carn_animals);
+        plant.add_to_total(strip.changes.plant);
+        herb.add_to_total(strip.changes.herb);
+        carn.add_to_total(strip.changes.carn);
+        baby.add_to_total(strip.changes.baby);
+        strip.changes = StatChanges();
+    }
+    uint64_t animals_done = SDL_GetPerformanceCounter();
+    phase_times.animals += animals_done - fluids_done;
+    // And place some plant matter. The placement generator is the one for the
+    // tile one past the last:
+    Random random(seed, tick, (uint64_t)get_width() * get_height());
     for (unsigned i = 0;
          i < (unsigned)(get_width() * get_height() * conf.plant_place_chance
              + random.generate(1.));
          ++i) {
-        plant.at(
-            random.generate() % get_width(), random.generate() % get_height())
-            += conf.plant_place_amount;
+        plant.add(random.generate() % get_width(),
+            random.generate() % get_height(), conf.plant_place_amount);
+        plant.add_to_total(conf.plant_place_amount);
     }
+    phase_times.plants += SDL_GetPerformanceCounter() - animals_done;
 }
 
 static uint8_t amount2color(float amount)
@@ -391,184 +492,164 @@ static uint8_t amount2color(float amount)
     }
 }
 
-void World::draw_smells(SDL_Renderer* renderer)
+// Do the same as amount2color for a vector of amounts, but without rounding to
+// an integer.
+static SimdFloat amount2color_simd(SimdFloat amount)
+{
+    return simd_min(simd_abs(simd_mul(amount, simd_set(3.))), simd_set(128.));
+}
+
+// Convert a row of smells to ARGB8888 pixels.
+static void smells2pixels(float const* carn, float const* plant,
+    float const* herb, uint32_t* dst, unsigned width)
 {
-    SDL_Rect viewport;
-    SDL_RenderGetViewport(renderer, &viewport);
-    SDL_Rect tile;
-    tile.w = viewport.w / get_width();
-    tile.h = viewport.h / get_height();
-    for (unsigned y = 0; y < get_height(); ++y) {
-        for (unsigned x = 0; x < get_width(); ++x) {
-            tile.x = (int)x * tile.w;
-            tile.y = (int)y * tile.h;
-            SDL_SetRenderDrawColor(renderer, amount2color(carn.at(x, y)),
-                amount2color(plant.at(x, y)), amount2color(herb.at(x, y)), 255);
-            SDL_RenderFillRect(renderer, &tile);
+    unsigned x = 0;
+    float reds[ANOSMELLYA_SIMD_WIDTH];
+    float greens[ANOSMELLYA_SIMD_WIDTH];
+    float blues[ANOSMELLYA_SIMD_WIDTH];
+    for (; x + ANOSMELLYA_SIMD_WIDTH <= width; x += ANOSMELLYA_SIMD_WIDTH) {
+        simd_store(reds, amount2color_simd(simd_load(carn + x)));
+        simd_store(greens, amount2color_simd(simd_load(plant + x)));
+        simd_store(blues, amount2color_simd(simd_load(herb + x)));
+        for (unsigned i = 0; i < ANOSMELLYA_SIMD_WIDTH; ++i) {
+            dst[x + i] = (uint32_t)0xFF << 24 | (uint32_t)reds[i] << 16
+                | (uint32_t)greens[i] << 8 | (uint32_t)blues[i];
         }
     }
+    for (; x < width; ++x) {
+        dst[x] = (uint32_t)0xFF << 24 | (uint32_t)amount2color(carn[x]) << 16
+            | (uint32_t)amount2color(plant[x]) << 8
+            | (uint32_t)amount2color(herb[x]);
+    }
 }
 
-void World::draw_affs(SDL_Renderer* renderer)
+void World::snapshot_band(Snapshot& snap, unsigned band, bool with_affs)
 {
-    SDL_Rect viewport;
-    SDL_RenderGetViewport(renderer, &viewport);
-    int tw = viewport.w / get_width();
-    int th = viewport.h / get_height();
-    for (unsigned y = 0; y < get_height(); ++y) {
-        for (unsigned x = 0; x < get_width(); ++x) {
-            Animal const& an = animal.at(x, y);
-            if (an.is_present) {
-                float plant_here = plant.at(x, y);
-                float carn_here = carn.at(x, y);
-                float herb_here = herb.at(x, y);
-                float baby_here = baby.at(x, y);
-                float max_acc = 0.;
-                // plant
-                Vec2D plant_acc(0., 0.);
-                add_output_impulse(plant_acc, get_smell(plant, x, y),
-                    an.plant_aff, plant_here, carn_here, herb_here, baby_here,
-                    an.food);
-                max_acc = fmaxf(max_acc, hypotf(plant_acc.x, plant_acc.y));
-                // herb
-                Vec2D herb_acc(0., 0.);
-                add_output_impulse(herb_acc, get_smell(herb, x, y), an.herb_aff,
-                    plant_here, carn_here, herb_here, baby_here, an.food);
-                max_acc = fmaxf(max_acc, hypotf(herb_acc.x, herb_acc.y));
-                // carn
-                Vec2D carn_acc(0., 0.);
-                add_output_impulse(carn_acc, get_smell(carn, x, y), an.carn_aff,
-                    plant_here, carn_here, herb_here, baby_here, an.food);
-                max_acc = fmaxf(max_acc, hypotf(carn_acc.x, carn_acc.y));
-                // baby
-                Vec2D baby_acc(0., 0.);
-                add_output_impulse(baby_acc, get_smell(baby, x, y), an.baby_aff,
-                    plant_here, carn_here, herb_here, baby_here, an.food);
-                max_acc = fmaxf(max_acc, hypotf(baby_acc.x, baby_acc.y));
-                // vel
-                Vec2D vel_acc(0., 0.);
-                add_output_impulse(vel_acc, an.vel, an.vel_aff, plant_here,
-                    carn_here, herb_here, baby_here, an.food);
-                max_acc = fmaxf(max_acc, hypotf(vel_acc.x, vel_acc.y));
-                if (max_acc > 0.) {
-                    int x1 = an.pos.x * tw;
-                    int y1 = an.pos.y * th;
-                    int x2;
-                    int y2;
-                    float scalar = 3. / max_acc;
-                    // plant
-                    SDL_SetRenderDrawColor(renderer, 0, 200, 0, 255);
-                    x2 = x1 + plant_acc.x * scalar * tw;
-                    y2 = y1 + plant_acc.y * scalar * th;
-                    SDL_RenderDrawLine(renderer, x1, y1, x2, y2);
-                    // herb
-                    SDL_SetRenderDrawColor(renderer, 0, 0, 200, 255);
-                    x2 = x1 + herb_acc.x * scalar * tw;
-                    y2 = y1 + herb_acc.y * scalar * th;
-                    SDL_RenderDrawLine(renderer, x1, y1, x2, y2);
-                    // carn
-                    SDL_SetRenderDrawColor(renderer, 200, 0, 0, 255);
-                    x2 = x1 + carn_acc.x * scalar * tw;
-                    y2 = y1 + carn_acc.y * scalar * th;
-                    SDL_RenderDrawLine(renderer, x1, y1, x2, y2);
-                    // baby
-                    SDL_SetRenderDrawColor(renderer, 200, 0, 200, 255);
-                    x2 = x1 + baby_acc.x * scalar * tw;
-                    y2 = y1 + baby_acc.y * scalar * th;
-                    SDL_RenderDrawLine(renderer, x1, y1, x2, y2);
-                    // vel
-                    SDL_SetRenderDrawColor(renderer, 200, 200, 200, 255);
-                    x2 = x1 + vel_acc.x * scalar * tw;
-                    y2 = y1 + vel_acc.y * scalar * th;
-                    SDL_RenderDrawLine(renderer, x1, y1, x2, y2);
-                }
-            }
+    unsigned width = get_width();
+    unsigned height = get_height();
+    unsigned start = band * STRIP_ROWS;
+    unsigned end = start + STRIP_ROWS < height ? start + STRIP_ROWS : height;
+    // Room for the rows if the fluids are stored in half precision:
+    std::vector<float> rows(carn.is_half() ? 3 * width : 0);
+    float* buffer = rows.data();
+    for (unsigned y = start; y < end; ++y) {
+        smells2pixels(carn.row(y, buffer), plant.row(y, buffer + width),
+            herb.row(y, buffer + 2 * width), &snap.smell_pixels[y * width],
+            width);
+    }
+    if (!with_affs) {
+        return;
+    }
+    std::vector<AffVectors>& affs = aff_bands[band];
+    affs.clear();
+    for (unsigned y = start; y < end; ++y) {
+        for (unsigned x = occupied.next(0, y); x < width;
+             x = occupied.next(x + 1, y)) {
+            add_aff_vectors(affs, x, y);
         }
     }
 }
 
-void World::draw_animals(SDL_Renderer* renderer)
+void World::take_snapshot(Snapshot& snap, bool with_affs)
 {
-    SDL_Rect viewport;
-    SDL_RenderGetViewport(renderer, &viewport);
-    SDL_Rect tile;
-    tile.w = viewport.w / get_width();
-    tile.h = viewport.h / get_height();
-    for (unsigned y = 0; y < get_height(); ++y) {
-        for (unsigned x = 0; x < get_width(); ++x) {
+    unsigned width = get_width();
+    unsigned height = get_height();
+    unsigned band_count = (height + STRIP_ROWS - 1) / STRIP_ROWS;
+    snap.width = width;
+    snap.height = height;
+    snap.smell_pixels.resize(width * height);
+    if (with_affs) {
+        aff_bands.resize(band_count);
+    }
+    auto do_band = [this, &snap, with_affs](unsigned i, unsigned) {
+        snapshot_band(snap, i, with_affs);
+    };
+    pool.run(band_count, do_band);
+    snap.affs.clear();
+    if (with_affs) {
+        for (unsigned i = 0; i < band_count; ++i) {
+            snap.affs.insert(
+                snap.affs.end(), aff_bands[i].begin(), aff_bands[i].end());
+        }
+    }
+    for (unsigned i = 0; i < LOOK_COUNT; ++i) {
+        snap.animals[i].clear();
+    }
+    for (unsigned y = 0; y < height; ++y) {
+        for (unsigned x = occupied.next(0, y); x < width;
+             x = occupied.next(x + 1, y)) {
             Animal const& an = animal.at(x, y);
-            if (an.is_present) {
-                tile.x = (an.pos.x - 0.5) * tile.w;
-                tile.y = (an.pos.y - 0.5) * tile.h;
-                if (an.is_carn) {
-                    if (is_receptive(an)) {
-                        receptive_carn_rect_buf.push_back(tile);
-                    } else {
-                        carn_rect_buf.push_back(tile);
-                    }
-                } else if (is_receptive(an)) {
-                    receptive_herb_rect_buf.push_back(tile);
-                } else {
-                    herb_rect_buf.push_back(tile);
-                }
+            AnimalLook look;
+            if (an.is_carn) {
+                look = is_receptive(an) ? LOOK_RECEPTIVE_CARN : LOOK_CARN;
+            } else {
+                look = is_receptive(an) ? LOOK_RECEPTIVE_HERB : LOOK_HERB;
             }
+            snap.animals[look].push_back(an.pos);
         }
     }
-    SDL_SetRenderDrawColor(renderer, 0, 0, 255, 255);
-    SDL_RenderFillRects(renderer, herb_rect_buf.data(), herb_rect_buf.size());
-    SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
-    SDL_RenderFillRects(renderer, carn_rect_buf.data(), carn_rect_buf.size());
-    SDL_SetRenderDrawColor(renderer, 0, 127, 255, 255);
-    SDL_RenderFillRects(renderer, receptive_herb_rect_buf.data(),
-        receptive_herb_rect_buf.size());
-    SDL_SetRenderDrawColor(renderer, 255, 127, 0, 255);
-    SDL_RenderFillRects(renderer, receptive_carn_rect_buf.data(),
-        receptive_carn_rect_buf.size());
-    carn_rect_buf.clear();
-    herb_rect_buf.clear();
-    receptive_carn_rect_buf.clear();
-    receptive_herb_rect_buf.clear();
+}
+
+void World::add_aff_vectors(std::vector<AffVectors>& affs, unsigned x,
+    unsigned y)
+{
+    Animal const& an = animal.at(x, y);
+    Genome const& genome = genomes.at(an.genome);
+    float plant_here = plant.at(x, y);
+    float carn_here = carn.at(x, y);
+    float herb_here = herb.at(x, y);
+    float baby_here = baby.at(x, y);
+    Vec2D grads[] = { plant.gradient_at(x, y), herb.gradient_at(x, y),
+        carn.gradient_at(x, y), baby.gradient_at(x, y), an.vel };
+    SmellAffinity const* genome_affs[] = { &genome.plant_aff, &genome.herb_aff,
+        &genome.carn_aff, &genome.baby_aff, &genome.vel_aff };
+    AffVectors aff;
+    aff.pos = an.pos;
+    float max_acc = 0.;
+    for (unsigned i = 0; i < 5; ++i) {
+        aff.accs[i] = Vec2D(0., 0.);
+        add_output_impulse(aff.accs[i], grads[i], *genome_affs[i],
+            plant_here, carn_here, herb_here, baby_here, an.food);
+        max_acc = fmaxf(max_acc, hypotf(aff.accs[i].x, aff.accs[i].y));
+    }
+    if (max_acc > 0.) {
+        // The longest vector is three tiles long:
+        float scalar = 3. / max_acc;
+        for (unsigned i = 0; i < 5; ++i) {
+            aff.accs[i].x *= scalar;
+            aff.accs[i].y *= scalar;
+        }
+        affs.push_back(aff);
+    }
 }
 
 void World::get_statistics(Statistics& stats)
 {
+    uint64_t start = SDL_GetPerformanceCounter();
     stats.world_width = get_width();
     stats.world_height = get_height();
     stats.tick = tick;
-    stats.herb_avg = Animal();
-    stats.herb_count = 0;
-    stats.carn_avg = Animal();
-    stats.carn_count = 0;
-    stats.plant_total = 0.;
-    stats.herb_total = 0.;
-    stats.carn_total = 0.;
-    stats.baby_total = 0.;
-    for (unsigned y = 0; y < get_height(); ++y) {
-        for (unsigned x = 0; x < get_width(); ++x) {
-            Animal const& an = animal.at(x, y);
-            if (an.is_present) {
-                if (an.is_carn) {
-                    stats.carn_avg.add(an);
-                    ++stats.carn_count;
-                } else {
-                    stats.herb_avg.add(an);
-                    ++stats.herb_count;
-                }
-            }
-            stats.plant_total += plant.at(x, y);
-            stats.herb_total += herb.at(x, y);
-            stats.carn_total += carn.at(x, y);
-            stats.baby_total += baby.at(x, y);
-        }
-    }
-    if (stats.herb_count > 0) {
-        stats.herb_avg.divide((float)stats.herb_count);
-    }
-    if (stats.carn_count > 0) {
-        stats.carn_avg.divide((float)stats.carn_count);
-    }
+    herb_totals.average(stats.herb_avg);
+    stats.herb_count = herb_totals.count;
+    carn_totals.average(stats.carn_avg);
+    stats.carn_count = carn_totals.count;
+    stats.plant_total = plant.get_total();
+    stats.herb_total = herb.get_total();
+    stats.carn_total = carn.get_total();
+    stats.baby_total = baby.get_total();
+    stats.skipped_fraction
+        = (double)(plant.get_skipped() + herb.get_skipped()
+              + carn.get_skipped() + baby.get_skipped())
+        / (4. * plant.get_block_count());
+    phase_times.stats += SDL_GetPerformanceCounter() - start;
 }
 
+void World::print_thread_usage(FILE* to) { pool.print_usage(to); }
+
+unsigned World::get_thread_count() { return pool.get_thread_count(); }
+
+PhaseTimes const& World::get_phase_times() { return phase_times; }
+
 void Statistics::print(FILE* to)
 {
     fprintf(to,
@@ -584,5 +665,6 @@ void Statistics::print(FILE* to)
     fprintf(to, ",\"plant_total\":%f", plant_total);
     fprintf(to, ",\"herb_total\":%f", herb_total);
     fprintf(to, ",\"carn_total\":%f", carn_total);
-    fprintf(to, ",\"baby_total\":%f}", baby_total);
+    fprintf(to, ",\"baby_total\":%f", baby_total);
+    fprintf(to, ",\"skipped_fraction\":%f}", skipped_fraction);
 }
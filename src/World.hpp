@@ -3,8 +3,13 @@
 
 #include "Animal.hpp"
 #include "Config.hpp"
+#include "Fluid.hpp"
+#include "GenomePool.hpp"
 #include "Grid.hpp"
+#include "Occupancy.hpp"
 #include "Random.hpp"
+#include "Snapshot.hpp"
+#include "ThreadPool.hpp"
 #include <SDL2/SDL.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -16,14 +21,15 @@ struct Statistics {
     unsigned world_width;
     unsigned world_height;
     uint64_t tick;
-    Animal herb_avg;
+    AnimalStats herb_avg;
     unsigned herb_count;
-    Animal carn_avg;
+    AnimalStats carn_avg;
     unsigned carn_count;
     float plant_total;
     float herb_total;
     float carn_total;
     float baby_total;
+    float skipped_fraction;
 
     Statistics& operator=(Statistics const& copy) = default;
 
@@ -31,63 +37,153 @@ struct Statistics {
     void print(FILE* to);
 };
 
-// Argument for internal fluid dispersal/evaporation worker threads. The worker
-// waits on start_sem and the main thread posts when the next fluid tick should
-// be calculated. The main thread then waits on stop_sem and the worker posts to
-// stop_sem when it is done. The worker loops until the grid pointer is NULL. an
-// empty worker thread slot is indicated by a NULL thread pointer.
-struct FluidWorker {
-    SDL_Thread* thread;
-    SDL_sem* start_sem;
-    SDL_sem* stop_sem;
-    Grid<float>* grid;
-    float dispersal;
-    float evap;
-
-    FluidWorker& operator=(FluidWorker const& copy) = default;
+// The time spent in each phase of ticking and collecting statistics, in
+// performance counter units. See SDL_GetPerformanceCounter.
+struct PhaseTimes {
+    uint64_t fluids;
+    uint64_t animals;
+    uint64_t plants;
+    uint64_t stats;
+
+    PhaseTimes();
+};
+
+// A band of rows of one fluid to calculate the next tick of. When the
+// reference kernel is used, each band covers a whole fluid.
+struct FluidJob {
+    Fluid* fluid;
+    unsigned start;
+    unsigned end;
+};
+
+// An animal's move, recorded for later.
+struct AnimalMove {
+    unsigned x;
+    unsigned y;
+    // The position before moving, to go back to if the way is blocked:
+    Vec2D pos_orig;
+};
+
+// Changes to the running statistics made while ticking animals. Each strip
+// keeps its own so that threads don't contend, and they are added up in a fixed
+// order once all animals are done.
+struct StatChanges {
+    AnimalTotals herb_animals;
+    AnimalTotals carn_animals;
+    // Smell added to the fluids:
+    double plant;
+    double herb;
+    double carn;
+    double baby;
+
+    StatChanges();
+};
+
+// A band of rows of animals ticked by one thread at a time. Strips are ticked
+// in phases, where strips of the same phase are far enough apart to be ticked
+// in parallel.
+struct AnimalStrip {
+    unsigned start;
+    unsigned end;
+    unsigned phase;
+    // Moves reaching too far to be done in parallel, done after all phases:
+    std::vector<AnimalMove> deferred;
+    StatChanges changes;
 };
 
 class World {
-public:
-    World(unsigned width, unsigned height, Random const& random,
-        Config const& conf, unsigned max_threads);
+    friend class Checkpoint;
 
-    ~World();
+public:
+    // The fluids are stored in half precision if half_fluids is true, unless
+    // the reference kernel is used.
+    World(unsigned width, unsigned height, uint32_t seed,
+        Config const& conf, unsigned max_threads, bool reference_fluids,
+        bool gradient_fields, bool half_fluids);
 
     unsigned get_width();
 
     unsigned get_height();
 
-    unsigned get_tick();
+    uint64_t get_tick();
 
     // Simulate one tick.
     void simulate();
 
-    void draw_smells(SDL_Renderer* renderer);
+    // Fill the snapshot with what is needed to draw the world as it is now.
+    // The affinity vectors are only filled if with_affs is true.
+    void take_snapshot(Snapshot& snap, bool with_affs);
 
-    void draw_affs(SDL_Renderer* renderer);
+    // Put the statistics into the stats struct. They are kept up to date as the
+    // world ticks, so this takes constant time.
+    void get_statistics(Statistics& stats);
 
-    void draw_animals(SDL_Renderer* renderer);
+    // Print how busy each thread has been as JSON to the file.
+    void print_thread_usage(FILE* to);
 
-    // Collect statistics and put them into the stats struct.
-    void get_statistics(Statistics& stats);
+    unsigned get_thread_count();
+
+    // Get the time spent in each phase since the world was created.
+    PhaseTimes const& get_phase_times();
 
 private:
-    Random random;
+    // Random numbers come from generators made from the seed, the tick, and
+    // the tile they are used for. See the Random class.
+    uint32_t seed;
     Config conf;
     uint64_t tick;
     Grid<Animal> animal;
-    Grid<float> plant;
-    Grid<float> herb;
-    Grid<float> carn;
-    Grid<float> baby;
-    std::vector<SDL_Rect> carn_rect_buf;
-    std::vector<SDL_Rect> herb_rect_buf;
-    std::vector<SDL_Rect> receptive_carn_rect_buf;
-    std::vector<SDL_Rect> receptive_herb_rect_buf;
-    // Three worker threads means four threads total for the four fluids. The
-    // world object can't be moved because workers reference these structs.
-    FluidWorker workers[3];
+    // The genomes of the animals in the grid:
+    GenomePool genomes;
+    // Which tiles of the animal grid have animals present, kept up to date so
+    // that loops over animals take time in proportion to the population:
+    Occupancy occupied;
+    Fluid plant;
+    Fluid herb;
+    Fluid carn;
+    Fluid baby;
+    // Running totals of the living animals of each kind:
+    AnimalTotals herb_totals;
+    AnimalTotals carn_totals;
+    // Whether to use the original fluid kernel, for comparison.
+    bool reference_fluids;
+    // The world object can't be moved because the pool's threads reference it.
+    ThreadPool pool;
+    // Since fluid bands are independent, they can be done in any order:
+    std::vector<FluidJob> fluid_jobs;
+    // Fluid scratch space for each thread of the pool:
+    std::vector<std::vector<float> > fluid_scratch;
+    std::vector<AnimalStrip> animal_strips;
+    // The indices of the strips of each phase:
+    std::vector<unsigned> phase_strips[3];
+    PhaseTimes phase_times;
+    // The affinity vectors of each band of STRIP_ROWS rows, worked out in
+    // parallel when taking snapshots:
+    std::vector<std::vector<AffVectors> > aff_bands;
+
+    // Get the index of the strip containing row y.
+    unsigned strip_of(unsigned y);
+
+    // Whether the tile (tx, ty) has yet to be ticked while ticking the tile
+    // (x, y). Nothing is ticked after deferred moves.
+    bool is_ticked_after(
+        unsigned x, unsigned y, unsigned tx, unsigned ty, bool deferred);
+
+    // Tick the animal at (x, y) of the strip, deferring its move if needed.
+    void tick_animal(unsigned x, unsigned y, AnimalStrip& strip);
+
+    // Fill in the smell pixels of the band of STRIP_ROWS rows, and work out
+    // its affinity vectors if with_affs is true.
+    void snapshot_band(Snapshot& snap, unsigned band, bool with_affs);
+
+    // Add the affinity vectors of the animal at (x, y) to affs, unless they
+    // are all zero.
+    void add_aff_vectors(std::vector<AffVectors>& affs, unsigned x, unsigned y);
+
+    // Move the animal, interacting with whatever is at the destination. Changes
+    // to the statistics are recorded in changes.
+    void move_animal(
+        AnimalMove const& move, StatChanges& changes, bool deferred);
 };
 
 } /* namespace anosmellya */
@@ -1,7 +1,12 @@
+#include "Checkpoint.hpp"
 #include "Config.hpp"
+#include "Drawer.hpp"
+#include "FrameWriter.hpp"
+#include "GridAllocator.hpp"
 #include "Options.hpp"
 #include "World.hpp"
 #include "assertions.hpp"
+#include "platform.hpp"
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,25 +15,127 @@
 
 using namespace anosmellya;
 
-static void simulate(SDL_Renderer* renderer, Options const& opts)
+// Queue statistics to be written if it's time to according to the options.
+static void print_stats(World& world, Statistics& stats, StatsWriter& writer,
+    Options const& opts)
+{
+    uint64_t tick = world.get_tick();
+    if (tick % opts.stat_interval == 0) {
+        world.get_statistics(stats);
+        writer.write(stats);
+    }
+    if (opts.flush_interval && tick % opts.flush_interval == 0) {
+        writer.flush();
+    }
+}
+
+// Queue a frame to be written if there are frames to write and it's time to
+// according to the options.
+static void write_frame(World& world, FrameWriter* frames, Options const& opts)
+{
+    if (frames && world.get_tick() % opts.frame_interval == 0) {
+        world.take_snapshot(frames->begin_frame(), false);
+        frames->end_frame();
+    }
+}
+
+// A tick no world reaches, for when no checkpoint has been saved:
+#define NO_SAVED_TICK (~(uint64_t)0)
+
+// Save a checkpoint if there is a checkpoint file and it's time to according to
+// the options. When finishing, it's always time to, unless this tick was
+// already saved. The saved tick is kept in saved_tick, which starts out as
+// NO_SAVED_TICK.
+static void save_checkpoint(
+    World& world, Options const& opts, bool finishing, uint64_t& saved_tick)
+{
+    if (!opts.checkpoint) {
+        return;
+    }
+    if (!finishing
+        && (!opts.checkpoint_every
+            || world.get_tick() % opts.checkpoint_every != 0)) {
+        return;
+    }
+    if (finishing && saved_tick == world.get_tick()) {
+        return;
+    }
+    if (!Checkpoint::save(world, opts.checkpoint)) {
+        fprintf(stderr, "Unable to save checkpoint '%s'; %s\n",
+            opts.checkpoint, strerror(errno));
+        return;
+    }
+    saved_tick = world.get_tick();
+}
+
+// Run the fixed number of ticks as fast as possible, without drawing or
+// handling events, then print how long it took.
+static void simulate_headless(Options const& opts, FILE* stat_file,
+    FrameWriter* frames, Checkpoint* restore)
+{
+    World world(opts.world_width, opts.world_height, opts.seed, opts.conf,
+        opts.max_threads, opts.reference_fluids, opts.gradient_fields,
+        opts.half_fluids);
+    if (restore) {
+        restore->restore(world);
+    }
+    Statistics stats;
+    StatsWriter writer(stat_file, opts.stat_format);
+    uint64_t saved_tick = NO_SAVED_TICK;
+    uint64_t start_tick = world.get_tick();
+    uint64_t start = SDL_GetPerformanceCounter();
+    while (world.get_tick() < opts.ticks) {
+        if (opts.print_stats) {
+            print_stats(world, stats, writer, opts);
+        }
+        write_frame(world, frames, opts);
+        world.simulate();
+        save_checkpoint(world, opts, false, saved_tick);
+    }
+    double seconds = (double)(SDL_GetPerformanceCounter() - start)
+        / (double)SDL_GetPerformanceFrequency();
+    uint64_t ticks = world.get_tick() - start_tick;
+    writer.flush();
+    save_checkpoint(world, opts, true, saved_tick);
+    // A restored world may already be done, and JSON has no NaN:
+    double rate = ticks && seconds > 0. ? ticks / seconds : 0.;
+    fprintf(stderr,
+        "{\"ticks\":%" ANOSMELLYA_UINT64_FMT ",\"seconds\":%f,"
+        "\"ticks_per_sec\":%f}\n",
+        ticks, seconds, rate);
+    if (opts.print_thread_usage) {
+        world.print_thread_usage(stderr);
+        fputc('\n', stderr);
+    }
+}
+
+static void simulate(SDL_Renderer* renderer, Options const& opts,
+    FILE* stat_file, FrameWriter* frames, Checkpoint* restore)
 {
     SDL_Event event;
-    Random random(opts.seed);
-    World world(opts.world_width, opts.world_height, random, opts.conf,
-        opts.max_threads);
+    World world(opts.world_width, opts.world_height, opts.seed, opts.conf,
+        opts.max_threads, opts.reference_fluids, opts.gradient_fields,
+        opts.half_fluids);
+    if (restore) {
+        restore->restore(world);
+    }
     Statistics stats;
+    StatsWriter writer(stat_file, opts.stat_format);
+    uint64_t saved_tick = NO_SAVED_TICK;
+    Drawer drawer(renderer);
+    Snapshot snap;
     bool do_draw_aff = false;
     bool do_draw = opts.draw;
     bool do_print_stats = opts.print_stats;
     bool do_run = true;
-    bool do_wait = true;
+    bool do_wait = opts.wait;
     for (;;) {
         bool do_redraw = do_run;
         bool do_one_tick = false;
         Uint32 ticks = SDL_GetTicks();
         while (SDL_PollEvent(&event)) {
             if (event.type == SDL_QUIT) {
-                return;
+                goto quit;
             } else if (event.type == SDL_KEYUP) {
                 switch (event.key.keysym.sym) {
                 case SDLK_a:
@@ -44,7 +151,7 @@ static void simulate(SDL_Renderer* renderer, Options const& opts)
                     do_redraw = true;
                     break;
                 case SDLK_q:
-                    return;
+                    goto quit;
                 case SDLK_r:
                     do_run = !do_run;
                     break;
@@ -53,7 +160,7 @@ static void simulate(SDL_Renderer* renderer, Options const& opts)
                     if (!do_print_stats) {
                         // Without this flush, some text might be buffered until
                         // statistic printing is turned on again.
-                        fflush(stdout);
+                        writer.flush();
                     }
                     break;
                 case SDLK_w:
@@ -64,25 +171,23 @@ static void simulate(SDL_Renderer* renderer, Options const& opts)
         }
         if (do_run || do_one_tick) {
             if (do_print_stats) {
-                unsigned tick = world.get_tick();
-                if (tick % opts.stat_interval == 0) {
-                    world.get_statistics(stats);
-                    stats.print(stdout);
-                    putchar('\n');
-                }
-                if (opts.flush_interval && tick % opts.flush_interval == 0) {
-                    fflush(stdout);
-                }
+                print_stats(world, stats, writer, opts);
             }
+            write_frame(world, frames, opts);
             world.simulate();
+            save_checkpoint(world, opts, false, saved_tick);
+            if (opts.ticks && world.get_tick() >= opts.ticks) {
+                goto quit;
+            }
         }
         if (opts.draw && do_redraw) {
             if (do_draw) {
-                world.draw_smells(renderer);
+                world.take_snapshot(snap, do_draw_aff);
+                drawer.draw_smells(snap);
                 if (do_draw_aff) {
-                    world.draw_affs(renderer);
+                    drawer.draw_affs(snap);
                 }
-                world.draw_animals(renderer);
+                drawer.draw_animals(snap);
             } else {
                 SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
                 SDL_RenderClear(renderer);
@@ -96,6 +201,183 @@ static void simulate(SDL_Renderer* renderer, Options const& opts)
             }
         }
     }
+quit:
+    save_checkpoint(world, opts, true, saved_tick);
+    if (opts.print_thread_usage) {
+        world.print_thread_usage(stderr);
+        fputc('\n', stderr);
+    }
+}
+
+// The state shared between the simulating and drawing threads when they are
+// separate. The flags are set by the drawing thread as keys are pressed, except
+// that either thread can set quit.
+struct SimThread {
+    Options const* opts;
+    FILE* stat_file;
+    FrameWriter* frames;
+    Checkpoint* restore;
+    SnapshotBuffer snapshots;
+    SDL_atomic_t quit;
+    SDL_atomic_t run;
+    SDL_atomic_t one_tick;
+    SDL_atomic_t print_stats;
+    SDL_atomic_t wait;
+    SDL_atomic_t want_affs;
+    // Whether to publish a snapshot even if the world hasn't changed:
+    SDL_atomic_t redraw;
+};
+
+static void toggle(SDL_atomic_t* flag)
+{
+    SDL_AtomicSet(flag, !SDL_AtomicGet(flag));
+}
+
+static int sim_thread_proc(void* arg)
+{
+    SimThread* sim = (SimThread*)arg;
+    Options const& opts = *sim->opts;
+    World world(opts.world_width, opts.world_height, opts.seed, opts.conf,
+        opts.max_threads, opts.reference_fluids, opts.gradient_fields,
+        opts.half_fluids);
+    if (sim->restore) {
+        sim->restore->restore(world);
+    }
+    Statistics stats;
+    StatsWriter writer(sim->stat_file, opts.stat_format);
+    uint64_t saved_tick = NO_SAVED_TICK;
+    bool do_print_stats = opts.print_stats;
+    while (!SDL_AtomicGet(&sim->quit)) {
+        Uint32 ticks = SDL_GetTicks();
+        bool do_run = SDL_AtomicGet(&sim->run);
+        bool do_one_tick = SDL_AtomicSet(&sim->one_tick, 0);
+        bool now_print_stats = SDL_AtomicGet(&sim->print_stats);
+        if (do_print_stats && !now_print_stats) {
+            // Without this flush, some text might be buffered until statistic
+            // printing is turned on again.
+            writer.flush();
+        }
+        do_print_stats = now_print_stats;
+        if (do_run || do_one_tick) {
+            if (do_print_stats) {
+                print_stats(world, stats, writer, opts);
+            }
+            write_frame(world, sim->frames, opts);
+            world.simulate();
+            save_checkpoint(world, opts, false, saved_tick);
+            if (opts.ticks && world.get_tick() >= opts.ticks) {
+                SDL_AtomicSet(&sim->quit, 1);
+            }
+        }
+        // Only snapshot as often as snapshots are drawn:
+        bool do_redraw = SDL_AtomicSet(&sim->redraw, 0);
+        if (opts.draw
+            && (do_redraw
+                || ((do_run || do_one_tick) && sim->snapshots.is_taken()))) {
+            world.take_snapshot(
+                sim->snapshots.get_back(), SDL_AtomicGet(&sim->want_affs));
+            sim->snapshots.publish();
+        }
+        if (SDL_AtomicGet(&sim->wait) || !do_run) {
+            Uint32 new_ticks = SDL_GetTicks();
+            if (new_ticks - ticks < opts.frame_delay) {
+                SDL_Delay(opts.frame_delay - (new_ticks - ticks));
+            }
+        }
+    }
+    save_checkpoint(world, opts, true, saved_tick);
+    if (opts.print_thread_usage) {
+        world.print_thread_usage(stderr);
+        fputc('\n', stderr);
+    }
+    return 0;
+}
+
+// Simulate on another thread while handling input and drawing the latest
+// snapshot of the world on this one. Returns false if the thread couldn't be
+// created, in which case nothing was done.
+static bool simulate_threaded(SDL_Renderer* renderer, Options const& opts,
+    FILE* stat_file, FrameWriter* frames, Checkpoint* restore)
+{
+    SDL_Event event;
+    SimThread sim;
+    sim.opts = &opts;
+    sim.stat_file = stat_file;
+    sim.frames = frames;
+    sim.restore = restore;
+    SDL_AtomicSet(&sim.quit, 0);
+    SDL_AtomicSet(&sim.run, 1);
+    SDL_AtomicSet(&sim.one_tick, 0);
+    SDL_AtomicSet(&sim.print_stats, opts.print_stats);
+    SDL_AtomicSet(&sim.wait, opts.wait);
+    SDL_AtomicSet(&sim.want_affs, 0);
+    SDL_AtomicSet(&sim.redraw, 1);
+    SDL_Thread* thread = SDL_CreateThread(sim_thread_proc, "simulate", &sim);
+    if (!thread) {
+        return false;
+    }
+    Drawer drawer(renderer);
+    Snapshot* shown = NULL;
+    bool do_draw = opts.draw;
+    while (!SDL_AtomicGet(&sim.quit)) {
+        bool do_redraw = false;
+        Uint32 ticks = SDL_GetTicks();
+        while (SDL_PollEvent(&event)) {
+            if (event.type == SDL_QUIT) {
+                SDL_AtomicSet(&sim.quit, 1);
+            } else if (event.type == SDL_KEYUP) {
+                switch (event.key.keysym.sym) {
+                case SDLK_a:
+                    toggle(&sim.want_affs);
+                    SDL_AtomicSet(&sim.redraw, 1);
+                    break;
+                case SDLK_d:
+                    do_draw = !do_draw;
+                    do_redraw = true;
+                    break;
+                case SDLK_f:
+                    SDL_AtomicSet(&sim.one_tick, 1);
+                    break;
+                case SDLK_q:
+                    SDL_AtomicSet(&sim.quit, 1);
+                    break;
+                case SDLK_r:
+                    toggle(&sim.run);
+                    break;
+                case SDLK_s:
+                    toggle(&sim.print_stats);
+                    break;
+                case SDLK_w:
+                    toggle(&sim.wait);
+                    break;
+                }
+            }
+        }
+        Snapshot* snap = sim.snapshots.take();
+        if (snap) {
+            shown = snap;
+            do_redraw = true;
+        }
+        if (opts.draw && do_redraw) {
+            if (do_draw && shown) {
+                drawer.draw_smells(*shown);
+                if (!shown->affs.empty()) {
+                    drawer.draw_affs(*shown);
+                }
+                drawer.draw_animals(*shown);
+            } else {
+                SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+                SDL_RenderClear(renderer);
+            }
+            SDL_RenderPresent(renderer);
+        }
+        Uint32 new_ticks = SDL_GetTicks();
+        if (new_ticks - ticks < opts.frame_delay) {
+            SDL_Delay(opts.frame_delay - (new_ticks - ticks));
+        }
+    }
+    SDL_WaitThread(thread, NULL);
+    return true;
 }
 
 int main(int argc, char* argv[])
@@ -104,10 +386,62 @@ int main(int argc, char* argv[])
     int status = EXIT_FAILURE;
     SDL_Window* window = NULL;
     SDL_Renderer* renderer = NULL;
-    Uint32 init_flags = SDL_INIT_TIMER | SDL_INIT_EVENTS;
+    FILE* stat_file = stdout;
+    FILE* frame_file = NULL;
+    FrameWriter* frames = NULL;
+    Checkpoint checkpoint;
+    Checkpoint* restore = NULL;
+    // Without drawing or waiting, a fixed number of ticks needs no input:
+    bool headless = !opts.draw && !opts.wait && opts.ticks;
+    Uint32 init_flags = 0;
+    if (!headless) {
+        init_flags |= SDL_INIT_TIMER | SDL_INIT_EVENTS;
+    }
     if (opts.draw) {
         init_flags |= SDL_INIT_VIDEO;
     }
+    if (opts.huge_pages) {
+        static HugePageAllocator huge_page_allocator;
+        GridAllocator::set_default(huge_page_allocator);
+    }
+    if (opts.restore) {
+        if (!checkpoint.open(opts.restore)) {
+            goto error_open_checkpoint;
+        }
+        checkpoint.apply_options(opts);
+        restore = &checkpoint;
+    }
+    if (opts.stat_file) {
+        stat_file
+            = fopen(opts.stat_file, opts.stat_format == STAT_JSON ? "w" : "wb");
+        if (!stat_file) {
+            fprintf(stderr, "Unable to open statistics file '%s'; %s\n",
+                opts.stat_file, strerror(errno));
+            goto error_open_stat_file;
+        }
+    }
+    if (opts.frames_out) {
+        if (!strcmp(opts.frames_out, "-")) {
+            // Statistics can be turned on with S whenever there's a window:
+            if (stat_file == stdout && (opts.print_stats || opts.draw)) {
+                fprintf(stderr,
+                    "Frames and statistics can't both go to standard "
+                    "output; use -stat-file%s\n",
+                    opts.print_stats ? "" : " or -no-draw");
+                goto error_open_frame_file;
+            }
+            frame_file = stdout;
+        } else {
+            frame_file = fopen(opts.frames_out, "wb");
+            if (!frame_file) {
+                fprintf(stderr, "Unable to open frame file '%s'; %s\n",
+                    opts.frames_out, strerror(errno));
+                goto error_open_frame_file;
+            }
+        }
+        frames = new FrameWriter(frame_file, opts.frame_format,
+            opts.pixel_size);
+    }
     if (SDL_Init(init_flags)) {
         fprintf(stderr, "SDL initialization failed; %s\n", SDL_GetError());
         goto error_sdl_init;
@@ -137,7 +471,12 @@ int main(int argc, char* argv[])
         SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
         SDL_RenderClear(renderer);
     }
-    simulate(renderer, opts);
+    if (headless) {
+        simulate_headless(opts, stat_file, frames, restore);
+    } else if (!opts.render_thread
+        || !simulate_threaded(renderer, opts, stat_file, frames, restore)) {
+        simulate(renderer, opts, stat_file, frames, restore);
+    }
     status = EXIT_SUCCESS;
     if (opts.draw) {
         SDL_DestroyRenderer(renderer);
@@ -149,5 +488,17 @@ error_create_surface:
 error_create_window:
     SDL_Quit();
 error_sdl_init:
+    if (frames) {
+        delete frames;
+        if (frame_file != stdout) {
+            fclose(frame_file);
+        }
+    }
+error_open_frame_file:
+    if (opts.stat_file) {
+        fclose(stat_file);
+    }
+error_open_stat_file:
+error_open_checkpoint:
     exit(status);
 }
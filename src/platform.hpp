@@ -15,4 +15,14 @@
 #define ANOSMELLYA_UINT64_FMT PRIu64
 #endif
 
+// ANOSMELLYA_CPU_PAUSE() should tell the CPU that the thread is spinning.
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define ANOSMELLYA_CPU_PAUSE() _mm_pause()
+#else
+#define ANOSMELLYA_CPU_PAUSE() \
+    do {                       \
+    } while (0)
+#endif
+
 #endif /* ANOSMELLYA_PLATFORM_H_ */
@@ -0,0 +1,289 @@
+#ifndef ANOSMELLYA_SIMD_H_
+#define ANOSMELLYA_SIMD_H_
+
+// The following is a thin layer over whatever float vector instructions the
+// compiler was told it could use. Kernels are written once in terms of these
+// functions and a scalar loop finishes off whatever doesn't fill a vector. Pass
+// something like CXXFLAGS=-mavx2 to make to get the wider vectors. Half
+// precision values are converted with F16C instructions given -mf16c, and with
+// integer instructions otherwise.
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define ANOSMELLYA_SIMD_WIDTH 8
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define ANOSMELLYA_SIMD_WIDTH 4
+#else
+#define ANOSMELLYA_SIMD_WIDTH 1
+#endif
+
+#include "Half.hpp"
+
+namespace anosmellya {
+
+#if defined(__AVX__)
+
+typedef __m256 SimdFloat;
+
+static inline SimdFloat simd_load(float const* from)
+{
+    return _mm256_loadu_ps(from);
+}
+
+static inline void simd_store(float* to, SimdFloat v)
+{
+    _mm256_storeu_ps(to, v);
+}
+
+static inline SimdFloat simd_set(float f) { return _mm256_set1_ps(f); }
+
+static inline SimdFloat simd_add(SimdFloat a, SimdFloat b)
+{
+    return _mm256_add_ps(a, b);
+}
+
+static inline SimdFloat simd_sub(SimdFloat a, SimdFloat b)
+{
+    return _mm256_sub_ps(a, b);
+}
+
+static inline SimdFloat simd_mul(SimdFloat a, SimdFloat b)
+{
+    return _mm256_mul_ps(a, b);
+}
+
+static inline SimdFloat simd_min(SimdFloat a, SimdFloat b)
+{
+    return _mm256_min_ps(a, b);
+}
+
+static inline SimdFloat simd_max(SimdFloat a, SimdFloat b)
+{
+    return _mm256_max_ps(a, b);
+}
+
+static inline SimdFloat simd_abs(SimdFloat v)
+{
+    return _mm256_andnot_ps(_mm256_set1_ps(-0.f), v);
+}
+
+#if defined(__F16C__)
+#define ANOSMELLYA_SIMD_F16C
+
+static inline SimdFloat simd_load_half(uint16_t const* from)
+{
+    return _mm256_cvtph_ps(_mm_loadu_si128((__m128i const*)from));
+}
+
+static inline void simd_store_half(uint16_t* to, SimdFloat v)
+{
+    _mm_storeu_si128(
+        (__m128i*)to, _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+}
+#endif
+
+#elif ANOSMELLYA_SIMD_WIDTH == 4
+
+typedef __m128 SimdFloat;
+
+static inline SimdFloat simd_load(float const* from)
+{
+    return _mm_loadu_ps(from);
+}
+
+static inline void simd_store(float* to, SimdFloat v) { _mm_storeu_ps(to, v); }
+
+static inline SimdFloat simd_set(float f) { return _mm_set1_ps(f); }
+
+static inline SimdFloat simd_add(SimdFloat a, SimdFloat b)
+{
+    return _mm_add_ps(a, b);
+}
+
+static inline SimdFloat simd_sub(SimdFloat a, SimdFloat b)
+{
+    return _mm_sub_ps(a, b);
+}
+
+static inline SimdFloat simd_mul(SimdFloat a, SimdFloat b)
+{
+    return _mm_mul_ps(a, b);
+}
+
+static inline SimdFloat simd_min(SimdFloat a, SimdFloat b)
+{
+    return _mm_min_ps(a, b);
+}
+
+static inline SimdFloat simd_max(SimdFloat a, SimdFloat b)
+{
+    return _mm_max_ps(a, b);
+}
+
+static inline SimdFloat simd_abs(SimdFloat v)
+{
+    return _mm_andnot_ps(_mm_set1_ps(-0.f), v);
+}
+
+#else
+
+typedef float SimdFloat;
+
+static inline SimdFloat simd_load(float const* from) { return *from; }
+
+static inline void simd_store(float* to, SimdFloat v) { *to = v; }
+
+static inline SimdFloat simd_set(float f) { return f; }
+
+static inline SimdFloat simd_add(SimdFloat a, SimdFloat b) { return a + b; }
+
+static inline SimdFloat simd_sub(SimdFloat a, SimdFloat b) { return a - b; }
+
+static inline SimdFloat simd_mul(SimdFloat a, SimdFloat b) { return a * b; }
+
+static inline SimdFloat simd_min(SimdFloat a, SimdFloat b)
+{
+    return a < b ? a : b;
+}
+
+static inline SimdFloat simd_max(SimdFloat a, SimdFloat b)
+{
+    return a > b ? a : b;
+}
+
+static inline SimdFloat simd_abs(SimdFloat v) { return v < 0.f ? -v : v; }
+
+#endif
+
+#if ANOSMELLYA_SIMD_WIDTH > 1 && !defined(ANOSMELLYA_SIMD_F16C)
+
+// Convert four half precision values, in the low 16 bits of the lanes, to
+// floats with SSE2 integer instructions, as half_to_float does.
+static inline __m128 halves_to_floats(__m128i halves)
+{
+    __m128i expmant = _mm_and_si128(halves, _mm_set1_epi32(0x7fff));
+    __m128i sign = _mm_slli_epi32(_mm_xor_si128(halves, expmant), 16);
+    __m128i bits = _mm_slli_epi32(expmant, 13);
+    __m128i exp = _mm_and_si128(bits, _mm_set1_epi32(0x7c00 << 13));
+    bits = _mm_add_epi32(bits, _mm_set1_epi32((127 - 15) << 23));
+    __m128i infnan = _mm_cmpeq_epi32(exp, _mm_set1_epi32(0x7c00 << 13));
+    bits = _mm_add_epi32(
+        bits, _mm_and_si128(infnan, _mm_set1_epi32((128 - 16) << 23)));
+    __m128i subnormal = _mm_cmpeq_epi32(exp, _mm_setzero_si128());
+    __m128 normalized = _mm_sub_ps(
+        _mm_castsi128_ps(_mm_add_epi32(bits, _mm_set1_epi32(1 << 23))),
+        _mm_castsi128_ps(_mm_set1_epi32(113 << 23)));
+    bits = _mm_or_si128(_mm_and_si128(subnormal, _mm_castps_si128(normalized)),
+        _mm_andnot_si128(subnormal, bits));
+    return _mm_castsi128_ps(_mm_or_si128(bits, sign));
+}
+
+// Convert four floats to half precision with SSE2 integer instructions, as
+// float_to_half does. The results are sign extended to 32 bits, so they can be
+// packed with _mm_packs_epi32.
+static inline __m128i floats_to_halves(__m128 floats)
+{
+    __m128 sign = _mm_and_ps(floats, _mm_set1_ps(-0.f));
+    __m128 abs = _mm_xor_ps(floats, sign);
+    __m128i bits = _mm_castps_si128(abs);
+    __m128i is_nan = _mm_castps_si128(_mm_cmpunord_ps(abs, abs));
+    __m128i special = _mm_or_si128(
+        _mm_and_si128(is_nan, _mm_set1_epi32(0x200)), _mm_set1_epi32(0x7c00));
+    __m128i regular = _mm_cmpgt_epi32(_mm_set1_epi32(0x47800000), bits);
+    // Subnormal results are rounded by the float unit, as in float_to_half:
+    __m128i subnormal = _mm_cmpgt_epi32(_mm_set1_epi32(0x38800000), bits);
+    __m128i magic = _mm_set1_epi32(126 << 23);
+    __m128i small = _mm_sub_epi32(
+        _mm_castps_si128(_mm_add_ps(abs, _mm_castsi128_ps(magic))), magic);
+    // Normal results are rounded to even by adding just under half of the
+    // last place, plus one if the last place kept is odd:
+    __m128i odd = _mm_srai_epi32(_mm_slli_epi32(bits, 31 - 13), 31);
+    __m128i normal = _mm_srli_epi32(
+        _mm_sub_epi32(
+            _mm_add_epi32(bits, _mm_set1_epi32(0xfff - ((127 - 15) << 23))),
+            odd),
+        13);
+    __m128i result = _mm_or_si128(_mm_and_si128(subnormal, small),
+        _mm_andnot_si128(subnormal, normal));
+    result = _mm_or_si128(_mm_and_si128(regular, result),
+        _mm_andnot_si128(regular, special));
+    return _mm_or_si128(result, _mm_srai_epi32(_mm_castps_si128(sign), 16));
+}
+
+#if ANOSMELLYA_SIMD_WIDTH == 8
+
+static inline SimdFloat simd_load_half(uint16_t const* from)
+{
+    __m128i halves = _mm_loadu_si128((__m128i const*)from);
+    __m128i zero = _mm_setzero_si128();
+    return _mm256_insertf128_ps(
+        _mm256_castps128_ps256(
+            halves_to_floats(_mm_unpacklo_epi16(halves, zero))),
+        halves_to_floats(_mm_unpackhi_epi16(halves, zero)), 1);
+}
+
+static inline void simd_store_half(uint16_t* to, SimdFloat v)
+{
+    _mm_storeu_si128((__m128i*)to,
+        _mm_packs_epi32(floats_to_halves(_mm256_castps256_ps128(v)),
+            floats_to_halves(_mm256_extractf128_ps(v, 1))));
+}
+
+#else
+
+static inline SimdFloat simd_load_half(uint16_t const* from)
+{
+    return halves_to_floats(_mm_unpacklo_epi16(
+        _mm_loadl_epi64((__m128i const*)from), _mm_setzero_si128()));
+}
+
+static inline void simd_store_half(uint16_t* to, SimdFloat v)
+{
+    __m128i halves = floats_to_halves(v);
+    _mm_storel_epi64((__m128i*)to, _mm_packs_epi32(halves, halves));
+}
+
+#endif
+
+#elif ANOSMELLYA_SIMD_WIDTH == 1
+
+static inline SimdFloat simd_load_half(uint16_t const* from)
+{
+    return half_to_float(*from);
+}
+
+static inline void simd_store_half(uint16_t* to, SimdFloat v)
+{
+    *to = float_to_half(v);
+}
+
+#endif
+
+// Add up the lanes of the vector in double precision.
+static inline double simd_total(SimdFloat v)
+{
+    float lanes[ANOSMELLYA_SIMD_WIDTH];
+    simd_store(lanes, v);
+    double total = 0.;
+    for (unsigned i = 0; i < ANOSMELLYA_SIMD_WIDTH; ++i) {
+        total += lanes[i];
+    }
+    return total;
+}
+
+// Get the largest lane of the vector.
+static inline float simd_largest(SimdFloat v)
+{
+    float lanes[ANOSMELLYA_SIMD_WIDTH];
+    simd_store(lanes, v);
+    float largest = lanes[0];
+    for (unsigned i = 1; i < ANOSMELLYA_SIMD_WIDTH; ++i) {
+        largest = lanes[i] > largest ? lanes[i] : largest;
+    }
+    return largest;
+}
+
+} /* namespace anosmellya */
+
+#endif /* ANOSMELLYA_SIMD_H_ */